@@ -91,3 +91,35 @@ if __name__ == "__main__":
   lru_prior.fixed_values.scale = 2.0
   with open("resources/asciipb/lin_reg_uni_fixed.asciipb", "w") as f:
     PrintMessage(lru_prior, f)
+
+
+  # DiagNNIG fixed values
+  diag_prior = hierarchy_prior_pb2.DiagNNIGPrior()
+  dim = 2
+  mu0 = dim*[5.5]
+  beta0 = dim*[2.0]
+  diag_prior.fixed_values.mean.size = len(mu0)
+  diag_prior.fixed_values.mean.data[:] = mu0
+  diag_prior.fixed_values.var_scaling = 0.1
+  diag_prior.fixed_values.shape = 2.0
+  diag_prior.fixed_values.scale.size = len(beta0)
+  diag_prior.fixed_values.scale.data[:] = beta0
+  with open("resources/asciipb/diag_nnig_fixed.asciipb", "w") as f:
+    PrintMessage(diag_prior, f)
+
+
+  # Factor fixed values
+  factor_prior = hierarchy_prior_pb2.FactorPrior()
+  dim = 4
+  mu0 = dim*[0.0]
+  beta0 = dim*[1.0]
+  factor_prior.fixed_values.mean.size = len(mu0)
+  factor_prior.fixed_values.mean.data[:] = mu0
+  factor_prior.fixed_values.mean_var = 10.0
+  factor_prior.fixed_values.num_factors = 2
+  factor_prior.fixed_values.loadings_var = 1.0
+  factor_prior.fixed_values.shape = 2.0
+  factor_prior.fixed_values.scale.size = len(beta0)
+  factor_prior.fixed_values.scale.data[:] = beta0
+  with open("resources/asciipb/factor_fixed.asciipb", "w") as f:
+    PrintMessage(factor_prior, f)
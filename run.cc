@@ -62,7 +62,12 @@ int main(int argc, char *argv[]) {
   mixing->set_prior(*mix_prior);
 
   // Set hierarchies hyperprior
-  std::string hier_prior_str = "bayesmix." + hier_type + "Prior";
+  // The fixed-dimension NNW hierarchies ("NNW2", "NNW3", ...) use NNWPrior
+  std::string hier_prior_type = hier_type;
+  if (hier_type.rfind("NNW", 0) == 0) {
+    hier_prior_type = "NNW";
+  }
+  std::string hier_prior_str = "bayesmix." + hier_prior_type + "Prior";
   auto hier_prior_desc = google::protobuf::DescriptorPool::generated_pool()
                              ->FindMessageTypeByName(hier_prior_str);
   if (hier_prior_desc == NULL) {
@@ -73,6 +78,15 @@ int main(int argc, char *argv[]) {
                          ->New();
   bayesmix::read_proto_from_file(hier_args, hier_prior);
   hier->set_prior(*hier_prior);
+  // Use a fixed-dimension NNW hierarchy when one exists for this dimension
+  if (hier_type == "NNW") {
+    auto nnw = std::dynamic_pointer_cast<NNWHierarchy>(hier);
+    std::string fixed_id = "NNW" + std::to_string(nnw->get_dim());
+    if (factory_hier.check_existence(fixed_id)) {
+      hier = factory_hier.create_object(fixed_id);
+      hier->set_prior(*hier_prior);
+    }
+  }
   hier->initialize();
 
   // Initialize RNG object
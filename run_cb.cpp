@@ -55,18 +55,16 @@ M load_csv2(const std::string &path) {
 int main(int argc, char const *argv[]) {
   cout << "Credible-balls test" << endl;
 
-  if (argc != 6) {
+  if (argc != 5 and argc != 6) {
     throw domain_error(
-        "Syntax : ./run_cb filename_mcmc filename_pe filename_out loss rate");
+        "Syntax : ./run_cb filename_mcmc filename_pe filename_out loss");
   }
 
   string filename_mcmc = argv[1];
   string filename_pe = argv[2];
   string filename_out = argv[3];
   int loss_type = std::stoi(argv[4]);
-  double learning_rate =
-      stoi(argv[5]);  // a good choice for "learning_rate" is 1 to 5
-  cout << "Learning rate: " << learning_rate << endl;
+  // a sixth argument (the former search rate) is accepted and ignored
 
   Eigen::MatrixXi mcmc, pe_tmp;
   Eigen::VectorXi pe;
@@ -82,7 +80,7 @@ int main(int argc, char const *argv[]) {
 
   CredibleBall CB =
       CredibleBall(static_cast<LOSS_FUNCTION>(loss_type), mcmc, 0.05, pe);
-  double r = CB.calculateRegion(learning_rate);
+  double r = CB.calculateRegion();
   cout << "radius: " << r << "\n";
 
   cout << "Vertical Upper Bound\n";
@@ -2,32 +2,26 @@
 
 #include "src/includes.hpp"
 
-Eigen::VectorXd epl_for_each_Kup(Eigen::MatrixXi &mcmc, int loss_type) {
-  int N = mcmc.cols();
-  Eigen::VectorXd epl_vec(mcmc.cols());
-  Eigen::VectorXi initial_partition =  Eigen::VectorXi::LinSpaced(N, 1 ,N);
-
-  for (int K = 1; K < N; K++) {
-    ClusterEstimator cp(mcmc,  static_cast<LOSS_FUNCTION>(loss_type),
-                         K, initial_partition);
-    epl_vec(K) = cp.expected_posterior_loss(
-        cp.cluster_estimate(GREEDY));
-  }
-
-  return epl_vec;
-}
-
 int main(int argc, char *argv[]) {
   //std::cout << "Running run_pe.cpp" << std::endl;
 
-  if (argc != 5) {
-    throw domain_error("Syntax : ./run_pe filename_in filename_out loss Kup");
+  if (argc < 5 or argc > 8) {
+    throw domain_error("Syntax : ./run_pe filename_in filename_out loss Kup "
+                       "[psm_storage [psm_threshold [scan_tolerance]]]");
   }
 
   std::string filename_in = argv[1];
   std::string filename_out = argv[2];
   int loss_type = std::stoi(argv[3]);
   int Kup = std::stoi(argv[4]);
+  // 0: dense, 1: packed 16-bit upper triangle, 2: sparse above the threshold
+  auto psm_storage = bayesmix::SimilarityStorage::dense;
+  if (argc > 5) {
+    psm_storage = static_cast<bayesmix::SimilarityStorage>(std::stoi(argv[5]));
+  }
+  float psm_threshold = (argc > 6) ? std::stof(argv[6]) : 0.0f;
+  // the scan over K stops when the EPL improves by less than this (relative)
+  double scan_tolerance = (argc > 7) ? std::stod(argv[7]) : 0.0;
   Eigen::MatrixXi mcmc;
   mcmc = bayesmix::read_eigen_matrix(filename_in);
 //  std::cout << "Matrix with dimensions : " << mcmc.rows()
@@ -37,14 +31,19 @@ int main(int argc, char *argv[]) {
   // Compute epl for each Kup to see the best
   if (Kup == -1) {
     cout << "Computation of epl for each K" << endl;
-    bayesmix::write_matrix_to_file(epl_for_each_Kup(mcmc, loss_type).transpose(),
-                                      filename_out);
+    // a single estimator (and copy of the sample) is shared by all K
+    Eigen::VectorXi initial_partition =  Eigen::VectorXi::LinSpaced(mcmc.cols(), 1 ,mcmc.cols());
+    ClusterEstimator cp(mcmc, static_cast<LOSS_FUNCTION>(loss_type),
+                         mcmc.cols(), initial_partition, psm_storage,
+                         psm_threshold);
+    bayesmix::write_matrix_to_file(
+        cp.epl_for_each_K(scan_tolerance, 2).transpose(), filename_out);
   }
 
   else if (Kup > 0) {
     Eigen::VectorXi initial_partition =  Eigen::VectorXi::LinSpaced(mcmc.cols(), 1 ,mcmc.cols());
     ClusterEstimator cp(mcmc, static_cast<LOSS_FUNCTION>(loss_type),
-                         Kup,initial_partition);
+                         Kup,initial_partition, psm_storage, psm_threshold);
     Eigen::VectorXi result = cp.cluster_estimate(GREEDY);
     bayesmix::write_matrix_to_file(result.transpose(),  filename_out);
 
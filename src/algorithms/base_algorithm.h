@@ -77,7 +77,7 @@ class BaseAlgorithm {
   virtual void initialize();
   virtual void sample_allocations() = 0;
   virtual void sample_unique_values() = 0;
-  void update_hierarchy_hypers();
+  virtual void update_hierarchy_hypers();
   virtual void print_ending_message() const {
     std::cout << "Done" << std::endl;
   };
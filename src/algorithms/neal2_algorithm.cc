@@ -66,8 +66,7 @@ Eigen::VectorXd Neal2Algorithm::get_cluster_lpdf(
     auto hiercast =
         std::dynamic_pointer_cast<DependentHierarchy>(unique_values[0]);
     // Probability of being assigned to a newly created cluster
-    loglpdf(n_clust) =
-        hiercast->marg_lpdf(data.row(data_idx), hier_covariates.row(data_idx));
+    loglpdf(n_clust) = marg_lpdf_cache(data_idx);
     for (size_t j = 0; j < n_clust; j++) {
       hiercast =
           std::dynamic_pointer_cast<DependentHierarchy>(unique_values[j]);
@@ -82,11 +81,35 @@ Eigen::VectorXd Neal2Algorithm::get_cluster_lpdf(
       loglpdf(j) = unique_values[j]->like_lpdf(data.row(data_idx));
     }
     // Probability of being assigned to a newly created cluster
-    loglpdf(n_clust) = unique_values[0]->marg_lpdf(data.row(data_idx));
+    loglpdf(n_clust) = marg_lpdf_cache(data_idx);
   }
   return loglpdf;
 }
 
+void Neal2Algorithm::update_marg_lpdf_cache() {
+  if (marg_lpdf_cache_valid) {
+    return;
+  }
+  // Hyperparameters are shared by all clusters, so any hierarchy will do
+  std::shared_ptr<BaseHierarchy> hier = unique_values[0];
+  int n_data = data.rows();
+  marg_lpdf_cache.resize(n_data);
+  if (hier->is_dependent()) {
+    auto hiercast = std::dynamic_pointer_cast<DependentHierarchy>(hier);
+#pragma omp parallel for
+    for (int i = 0; i < n_data; i++) {
+      marg_lpdf_cache(i) =
+          hiercast->marg_lpdf(data.row(i), hier_covariates.row(i));
+    }
+  } else {
+#pragma omp parallel for
+    for (int i = 0; i < n_data; i++) {
+      marg_lpdf_cache(i) = hier->marg_lpdf(data.row(i));
+    }
+  }
+  marg_lpdf_cache_valid = true;
+}
+
 void Neal2Algorithm::print_startup_message() const {
   std::string msg = "Running Neal2 algorithm with " +
                     unique_values[0]->get_id() + " hierarchies, " +
@@ -100,12 +123,14 @@ void Neal2Algorithm::initialize() {
     throw std::invalid_argument(
         "This algorithm only supports conjugate hierarchies");
   }
+  marg_lpdf_cache_valid = false;
 }
 
 void Neal2Algorithm::sample_allocations() {
   // Initialize relevant values
   unsigned int n_data = data.rows();
   auto &rng = bayesmix::Rng::Instance().get();
+  update_marg_lpdf_cache();
   // Loop over data points
   for (size_t i = 0; i < n_data; i++) {
     unsigned int n_clust = unique_values.size();
@@ -145,3 +170,10 @@ void Neal2Algorithm::sample_allocations() {
 void Neal2Algorithm::sample_unique_values() {
   for (auto &clus : unique_values) clus->sample_given_data();
 }
+
+void Neal2Algorithm::update_hierarchy_hypers() {
+  BaseAlgorithm::update_hierarchy_hypers();
+  if (unique_values[0]->has_fixed_hypers() == false) {
+    marg_lpdf_cache_valid = false;
+  }
+}
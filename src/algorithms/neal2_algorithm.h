@@ -28,6 +28,16 @@
 
 class Neal2Algorithm : public MarginalAlgorithm {
  protected:
+  //! Prior-predictive (marginal) log-density of each datum, i.e. the
+  //! new-cluster term of get_cluster_lpdf(), which only depends on the datum
+  //! and on the hyperparameters
+  Eigen::VectorXd marg_lpdf_cache;
+  //! False when the hyperparameters may have changed since the cache was filled
+  bool marg_lpdf_cache_valid = false;
+
+  //! Fills the marginal log-density cache, if needed
+  void update_marg_lpdf_cache();
+
   // AUXILIARY TOOLS
   //! Computes marginal contribution of a given iteration & cluster
   Eigen::VectorXd lpdf_marginal_component(
@@ -47,6 +57,7 @@ class Neal2Algorithm : public MarginalAlgorithm {
   void initialize() override;
   void sample_allocations() override;
   void sample_unique_values() override;
+  void update_hierarchy_hypers() override;
 
  public:
   // DESTRUCTOR AND CONSTRUCTORS
@@ -1,13 +1,25 @@
 #include "ClusterEstimator.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include "src/utils/cluster_utils.h"
+#include "src/utils/rng.h"
 using namespace std;
 
 ClusterEstimator::ClusterEstimator(Eigen::MatrixXi &mcmc_sample_, LOSS_FUNCTION loss_type,
-                  int Kup, Eigen::VectorXi &initial_partition_)
-    : loss_function(0)
+                  int Kup, Eigen::VectorXi &initial_partition_,
+                  bayesmix::SimilarityStorage psm_storage, float psm_threshold)
+    : loss_function(0), loss_type(loss_type)
 {
-  mcmc_sample = mcmc_sample_;
-  T = mcmc_sample.rows();
-  N = mcmc_sample.cols();
+  // identical partitions of the sample are only stored and evaluated once
+  bayesmix::UniquePartitions unique = bayesmix::unique_partitions(mcmc_sample_);
+  mcmc_sample = unique.partitions;
+  sample_counts = unique.counts;
+  compact_sample.reset(new CompactPartitions(mcmc_sample));
+  T = mcmc_sample_.rows();
+  N = mcmc_sample_.cols();
   K_up = Kup;
   initial_partition= initial_partition_;
   switch(loss_type) {
@@ -20,26 +32,55 @@ ClusterEstimator::ClusterEstimator(Eigen::MatrixXi &mcmc_sample_, LOSS_FUNCTION
       loss_function = new VariationInformation(true);
       break;
     }
+    case VARIATION_INFORMATION_LOWER_BOUND: {
+      // the estimate minimizes a bound to the VI expected posterior loss
+      loss_function = new VariationInformation(false);
+      break;
+    }
     default:
       throw std::domain_error("Loss function not recognized");
   }
+
+  if (loss_type == BINDER_LOSS or
+      loss_type == VARIATION_INFORMATION_LOWER_BOUND) {
+    psm = bayesmix::posterior_similarity(mcmc_sample, psm_storage,
+                                         psm_threshold, sample_counts);
+  }
 }
 
 ClusterEstimator::~ClusterEstimator() {
   delete loss_function;
 }
 
-double ClusterEstimator::expected_posterior_loss(Eigen::VectorXi a)
-{
-  double epl = 0;
-  loss_function->SetFirstCluster(a);
-
-  for (int t = 0; t < T; t++) {
-    loss_function->SetSecondCluster(mcmc_sample.row(t));
-    epl += loss_function->Loss();
+unique_ptr<IncrementalLoss> ClusterEstimator::make_incremental_loss(
+    int L) const {
+  switch (loss_type) {
+    case BINDER_LOSS: {
+      auto binder = static_cast<BinderLoss*>(loss_function);
+      return unique_ptr<IncrementalLoss>(new BinderIncrementalLoss(
+          *psm, binder->GetL1(), binder->GetL2(), L));
+    }
+    case VARIATION_INFORMATION:
+      return unique_ptr<IncrementalLoss>(
+          new VIIncrementalLoss(*compact_sample, sample_counts, false, L));
+    case VARIATION_INFORMATION_NORMALIZED:
+      return unique_ptr<IncrementalLoss>(
+          new VIIncrementalLoss(*compact_sample, sample_counts, true, L));
+    case VARIATION_INFORMATION_LOWER_BOUND:
+      return unique_ptr<IncrementalLoss>(
+          new VILowerBoundIncrementalLoss(*psm, L));
+    default:
+      throw std::domain_error("Loss function not recognized");
   }
+}
 
-  return epl / T;
+double ClusterEstimator::expected_posterior_loss(Eigen::VectorXi a) const
+{
+  if (loss_type == VARIATION_INFORMATION_LOWER_BOUND) {
+    return VILowerBoundIncrementalLoss::LowerBound(*psm, a);
+  }
+  return loss_function->LossAgainstSample(a, *compact_sample)
+             .dot(sample_counts.cast<double>()) / T;
 }
 
 
@@ -48,56 +89,15 @@ Eigen::VectorXi ClusterEstimator::cluster_estimate(MINIMIZATION_METHOD method) {
     case GREEDY:
       return greedy_algorithm(initial_partition);
 
+    case MULTI_START:
+      return multi_start_algorithm();
+
     default:
       throw std::domain_error("Non valid method chosen");
   }
 }
 
 
-/**
- * replace (vec[i], vec[i+1], ..., vec[N-1]) with (vec[i+1], ..., vec[N-1], ?)
- * and then resize
- */
-void delete_ith_element(Eigen::VectorXi &vec, int i) {
-  if (vec.size() == 0) {
-    throw std::domain_error("Can't delete an element from empty vector");
-  }
-  if (i >= vec.size() or i < 0) {
-    throw std::domain_error("Wrong index to delete element");
-  }
-
-  copy(vec.data() + i + 1, vec.data() + vec.size(), vec.data() + i);
-  vec.conservativeResize(vec.size() - 1);
-}
-
-/**
- * Return the index of the max coefficient in vec
- * No such method seems to exist in Eigen lib
- */
-int argmax(Eigen::VectorXd &vec) {
-  int argmax(0);
-  double max(0);
-  for (int index = 0; index < vec.size(); index++) {
-    if (vec(index) > max) {
-      max = vec(index);
-      argmax = index;
-    }
-  }
-  return argmax;
-}
-
-int argmin(Eigen::VectorXd &vec) {
-  int argmin(0);
-  double min(vec(0));
-  for (int index = 0; index < vec.size(); index++) {
-    if (vec(index) < min) {
-      min = vec(index);
-      argmin = index;
-    }
-  }
-  return argmin;
-}
-
 /**
  * The output of the greedy algorithm is an estimate with random cluster labels
  * This function aims to reordonning and renaming these labels to have a
@@ -125,39 +125,394 @@ void rename_labels(Eigen::VectorXi &cluster) {
 
 /**
  * a starting partition
+ *
+ * Each datum is visited in random order and moved to the label in 1..K_up
+ * with the smallest expected posterior loss, until a whole sweep leaves the
+ * partition unchanged. The EPL of each candidate label is evaluated
+ * incrementally (see IncrementalLoss), so that a sweep costs O(N^2) for
+ * Binder loss and O(N * K_up * T) for the variation of information.
  */
 Eigen::VectorXi ClusterEstimator::greedy_algorithm(Eigen::VectorXi &a) {
-  double phi_a(expected_posterior_loss(a)), phi_stop;
-  Eigen::VectorXi nu, a_modified;
-  Eigen::VectorXd epl_vec(K_up  );
+  vector<int> z = internal_labels(a, K_up);
+  int cmpt = greedy_sweeps(z, K_up, bayesmix::Rng::Instance().get(),
+                           chrono::steady_clock::time_point::max());
+
+  for (int i = 0; i < N; i++) {
+    a(i) = z[i] + 1;
+  }
+  rename_labels(a);
+//  cout << endl << "FINAL CLUSTER : " << a.transpose() << endl;
+  cout << T << ":" << N << " --> " << cmpt << " while loops." << endl;
+  return a;
+}
+
+vector<int> ClusterEstimator::internal_labels(const Eigen::VectorXi &a,
+                                             int K) const {
+  // Labels 1..K become 0..K-1, other labels of the starting partition are put
+  // after them and disappear during the first sweep
+  vector<int> z(N);
+  map<int, int> overflow;
+  for (int i = 0; i < N; i++) {
+    if (a(i) >= 1 and a(i) <= K) {
+      z[i] = a(i) - 1;
+    } else {
+      auto it = overflow.emplace(a(i), K + overflow.size());
+      z[i] = it.first->second;
+    }
+  }
+  return z;
+}
+
+int ClusterEstimator::greedy_sweeps(vector<int> &z, int K, mt19937_64 &rng,
+                                    chrono::steady_clock::time_point deadline)
+    const {
+  // the start may use fewer than K labels, or overflow labels >= K
+  vector<int> sizes(max(K, *max_element(z.begin(), z.end()) + 1), 0);
+  for (int i = 0; i < N; i++) {
+    sizes[z[i]]++;
+  }
+
+  unique_ptr<IncrementalLoss> loss = make_incremental_loss(K);
+  vector<int> order(N);
+  iota(order.begin(), order.end(), 0);
+  vector<int> candidates;
+  vector<double> costs;
+  const double tolerance = 1.0e-10;
   bool stop = false;
   int cmpt = 0;
 
-  while(!stop) {
-    phi_stop = phi_a;
-    nu = Eigen::VectorXi::LinSpaced(N, 1 ,N);
-    while(nu.size() != 0) {
-      int i = rand() % nu.size();  // random int between 0 and size-1
-      int nu_i = nu(i);
-      delete_ith_element(nu, i);
-      for (int s = 1; s <= K_up; s++) {
-        // ai_r->s means a[i] is now equal to s
-        a_modified = a;
-        a_modified(nu_i - 1) = s;
-        epl_vec(s - 1) = expected_posterior_loss(a_modified);
+  // the first sweep is always completed, as it moves the data out of the
+  // overflow labels >= K of the starting partition
+  do {
+    stop = true;
+    // rebuilt at each sweep, so that round-off errors do not accumulate
+    loss->Initialize(z);
+    shuffle(order.begin(), order.end(), rng);
+    for (int i : order) {
+      int r = z[i];
+      loss->Remove(i);
+      sizes[r]--;
+
+      // all the empty labels give the same loss: only the first one is tried
+      candidates.clear();
+      bool empty_found = false;
+      for (int s = 0; s < K; s++) {
+        if (sizes[s] > 0 or !empty_found) {
+          candidates.push_back(s);
+          empty_found |= (sizes[s] == 0);
+        }
+      }
+      loss->InsertionCosts(i, candidates, costs);
+
+      // on ties, stay in the current group or take the smallest label
+      int best = -1;
+      double best_cost = 0.0;
+      for (size_t k = 0; k < candidates.size(); k++) {
+        if (candidates[k] == r) {
+          best = r;
+          best_cost = costs[k];
+          break;
+        }
+      }
+      for (size_t k = 0; k < candidates.size(); k++) {
+        double margin = tolerance * max(1.0, fabs(best_cost));
+        if (best < 0 or costs[k] < best_cost - margin) {
+          best = candidates[k];
+          best_cost = costs[k];
+        }
+      }
+
+      loss->Insert(i, best);
+      sizes[best]++;
+      if (best != r) {
+        z[i] = best;
+        stop = false;
       }
-      a(nu_i - 1) = argmin(epl_vec) + 1;
-      phi_a = expected_posterior_loss(a);
-    }
-    if (phi_stop == phi_a) {
-      stop = true;
     }
     cmpt++;
+  } while (!stop and chrono::steady_clock::now() < deadline);
+  return cmpt;
+}
+
+
+/**
+ * Average linkage clustering of the data with distances 1 - psm(i, j), by the
+ * nearest-neighbor chain algorithm: O(N^2) time and memory.
+ *
+ * @return the N-1 merges as pairs of data (one from each of the merged
+ * groups), sorted by increasing height
+ */
+static vector<pair<int, int>> average_linkage(const bayesmix::SimilarityMatrix &psm) {
+  int n = psm.size();
+  Eigen::MatrixXf dist(n, n);
+  for (int j = 0; j < n; j++) {
+    for (int i = 0; i < n; i++) {
+      dist(i, j) = 1.0f - psm(i, j);
+    }
   }
+  vector<int> sizes(n, 1);
+  vector<bool> active(n, true);
+  vector<int> chain;
+  vector<pair<float, pair<int, int>>> merges;
+  int next = 0;  // first index that may still be active
 
-  rename_labels(a);
-//  cout << endl << "FINAL CLUSTER : " << a.transpose() << endl;
-  cout << mcmc_sample.rows() << ":" << mcmc_sample.cols() << " --> " << cmpt << " while loops." << endl;
-  return a;
+  while ((int)merges.size() < n - 1) {
+    if (chain.empty()) {
+      while (!active[next]) next++;
+      chain.push_back(next);
+    }
+    int a = chain.back();
+    // nearest active group, preferring the previous one of the chain on ties
+    int b = chain.size() > 1 ? chain[chain.size() - 2] : -1;
+    float d_ab = b >= 0 ? dist(b, a) : INFINITY;
+    const float *col = dist.col(a).data();
+    for (int c = 0; c < n; c++) {
+      if (active[c] and c != a and col[c] < d_ab) {
+        b = c;
+        d_ab = col[c];
+      }
+    }
+
+    if (chain.size() > 1 and b == chain[chain.size() - 2]) {
+      chain.pop_back();
+      chain.pop_back();
+      // the merged group takes the index of a (Lance-Williams update)
+      merges.push_back({d_ab, {a, b}});
+      float wa = sizes[a];
+      float wb = sizes[b];
+      for (int c = 0; c < n; c++) {
+        if (active[c] and c != a and c != b) {
+          float d = (wa * dist(c, a) + wb * dist(c, b)) / (wa + wb);
+          dist(c, a) = d;
+          dist(a, c) = d;
+        }
+      }
+      sizes[a] += sizes[b];
+      active[b] = false;
+    } else {
+      chain.push_back(b);
+    }
+  }
+
+  stable_sort(merges.begin(), merges.end(),
+              [](const pair<float, pair<int, int>> &x,
+                 const pair<float, pair<int, int>> &y) {
+                return x.first < y.first;
+              });
+  vector<pair<int, int>> sorted;
+  for (auto &m : merges) {
+    sorted.push_back(m.second);
+  }
+  return sorted;
+}
+
+/**
+ * Cuts the dendrogram given by average_linkage into K groups.
+ *
+ * @return the groups as labels 1..K
+ */
+static Eigen::VectorXi cut_dendrogram(const vector<pair<int, int>> &merges,
+                                      int n, int K) {
+  vector<int> parent(n);
+  iota(parent.begin(), parent.end(), 0);
+  auto find = [&parent](int i) {
+    while (parent[i] != i) {
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+    }
+    return i;
+  };
+  for (int m = 0; m < n - K; m++) {
+    parent[find(merges[m].second)] = find(merges[m].first);
+  }
+  Eigen::VectorXi labels(n);
+  for (int i = 0; i < n; i++) {
+    labels(i) = find(i);
+  }
+  rename_labels(labels);
+  return labels;
 }
 
+
+/**
+ * Runs the greedy algorithm from several starting partitions, in parallel, and
+ * returns the estimate with the smallest expected posterior loss. The
+ * starting points are the initial partition and, in turn, random partitions
+ * with K_up labels, partitions of the MCMC sample, and cuts into 1..K_up groups
+ * of the average linkage clustering of the posterior similarity matrix. Each
+ * start has its own random generator seeded from bayesmix::Rng, so that,
+ * as long as the time budget is not reached, the result does not depend on
+ * the number of threads.
+ * Starts are no longer launched once the time budget is over, and running
+ * ones stop at the end of their current sweep. Every start that is launched
+ * completes at least one sweep, so that its estimate has at most K_up
+ * groups.
+ */
+Eigen::VectorXi ClusterEstimator::multi_start_algorithm() {
+  auto deadline = chrono::steady_clock::now() +
+      chrono::duration_cast<chrono::steady_clock::duration>(
+          chrono::duration<double>(time_budget));
+
+  // The dendrogram needs a dense N*N matrix, it is skipped for large N
+  const int max_linkage_size = 10000;
+  vector<pair<int, int>> merges;
+  if (N <= max_linkage_size) {
+    if (psm) {
+      merges = average_linkage(*psm);
+    } else {
+      merges = average_linkage(*bayesmix::posterior_similarity(
+          mcmc_sample, bayesmix::SimilarityStorage::dense, 0.0f,
+          sample_counts));
+    }
+  }
+  int n_kinds = merges.empty() ? 2 : 3;
+
+  auto &master = bayesmix::Rng::Instance().get();
+  vector<unsigned long> seeds(n_starts);
+  for (auto &seed : seeds) {
+    seed = master();
+  }
+
+  Eigen::VectorXi best;
+  double best_epl = INFINITY;
+  int best_start = n_starts;
+#pragma omp parallel for schedule(dynamic)
+  for (int s = 0; s < n_starts; s++) {
+    if (s > 0 and chrono::steady_clock::now() >= deadline) {
+      continue;
+    }
+    mt19937_64 rng(seeds[s]);
+    Eigen::VectorXi a;
+    if (s == 0) {
+      a = initial_partition;
+    } else {
+      switch (s % n_kinds) {
+        case 0: {
+          uniform_int_distribution<int> label(1, K_up);
+          a = Eigen::VectorXi::NullaryExpr(N, [&]() { return label(rng); });
+          break;
+        }
+        case 1: {
+          discrete_distribution<int> row(sample_counts.data(),
+                                         sample_counts.data() + sample_counts.size());
+          a = mcmc_sample.row(row(rng)).transpose();
+          rename_labels(a);
+          break;
+        }
+        default: {
+          uniform_int_distribution<int> groups(1, min(K_up, N));
+          a = cut_dendrogram(merges, N, groups(rng));
+        }
+      }
+    }
+
+    vector<int> z = internal_labels(a, K_up);
+    greedy_sweeps(z, K_up, rng, deadline);
+    for (int i = 0; i < N; i++) {
+      a(i) = z[i] + 1;
+    }
+    double epl = expected_posterior_loss(a);
+#pragma omp critical
+    {
+      if (epl < best_epl or (epl == best_epl and s < best_start)) {
+        best = a;
+        best_epl = epl;
+        best_start = s;
+      }
+    }
+  }
+
+  rename_labels(best);
+  cout << "Best EPL " << best_epl << " found from start " << best_start
+       << endl;
+  return best;
+}
+
+void ClusterEstimator::set_multi_start(int n_starts_, double time_budget_) {
+  if (n_starts_ < 1) {
+    throw std::domain_error("At least one start is needed");
+  }
+  n_starts = n_starts_;
+  time_budget = time_budget_;
+}
+
+
+/**
+ * Minimum expected posterior loss for each maximum number of clusters
+ * K = 1..K_up, found by the greedy algorithm.
+ * The values of K are processed in parallel, in blocks of a fixed size, so
+ * that the result does not depend on the number of threads. For every K the
+ * greedy algorithm is run from the initial partition and, after the first
+ * block, also warm-started from the best partition of the previous blocks.
+ * The EPL for K is the smallest one found for any K' <= K: the curve is thus
+ * non-increasing. The scan stops when the relative improvement given by a
+ * block is below "tolerance" for "patience" blocks in a row (tolerance = 0
+ * never stops).
+ *
+ * @return the EPL for K = 1..K_last, K_last <= K_up being the last K scanned
+ */
+Eigen::VectorXd ClusterEstimator::epl_for_each_K(double tolerance,
+                                                 int patience) {
+  const int block = 8;
+  auto &master = bayesmix::Rng::Instance().get();
+  auto no_deadline = chrono::steady_clock::time_point::max();
+
+  Eigen::VectorXd epl(K_up);
+  Eigen::VectorXi best = initial_partition;
+  double best_epl = INFINITY;
+  int flat_blocks = 0;
+  int K_last = 0;
+
+  for (int K_first = 1; K_first <= K_up; K_first += block) {
+    int K_end = min(K_up + 1, K_first + block);
+    // two starts for each K, the second one only after the first block
+    int n_starts_K = K_first > 1 ? 2 : 1;
+    vector<unsigned long> seeds(2 * (K_end - K_first));
+    for (auto &seed : seeds) {
+      seed = master();
+    }
+    vector<Eigen::VectorXi> estimates(K_end - K_first);
+#pragma omp parallel for schedule(dynamic)
+    for (int K = K_first; K < K_end; K++) {
+      double K_epl = INFINITY;
+      for (int start = 0; start < n_starts_K; start++) {
+        mt19937_64 rng(seeds[2 * (K - K_first) + start]);
+        vector<int> z =
+            internal_labels(start == 0 ? initial_partition : best, K);
+        greedy_sweeps(z, K, rng, no_deadline);
+        Eigen::VectorXi a(N);
+        for (int i = 0; i < N; i++) {
+          a(i) = z[i] + 1;
+        }
+        double a_epl = expected_posterior_loss(a);
+        if (a_epl < K_epl) {
+          K_epl = a_epl;
+          estimates[K - K_first] = a;
+        }
+      }
+      epl(K - 1) = K_epl;
+    }
+
+    double previous_epl = best_epl;
+    // any partition found for a smaller K is also valid for K
+    for (int K = K_first; K < K_end; K++) {
+      if (epl(K - 1) < best_epl) {
+        best_epl = epl(K - 1);
+        best = estimates[K - K_first];
+      }
+      epl(K - 1) = best_epl;
+    }
+    K_last = K_end - 1;
+    cout << "K = " << K_first << ".." << K_last << " --> EPL " << best_epl
+         << endl;
+
+    bool flat = isfinite(previous_epl) and
+        previous_epl - best_epl <= tolerance * fabs(previous_epl);
+    flat_blocks = flat ? flat_blocks + 1 : 0;
+    if (tolerance > 0 and flat_blocks >= patience) {
+      break;
+    }
+  }
+
+  return epl.head(K_last);
+}
@@ -4,15 +4,22 @@
 #include "lossfunction/LossFunction.hpp"
 #include "lossfunction/BinderLoss.hpp"
 #include "lossfunction/VariationInformation.hpp"
+#include "lossfunction/IncrementalLoss.hpp"
+#include "src/utils/cluster_utils.h"
 #include <Eigen/Dense>
+#include <chrono>
 #include <iostream>
 #include <cstdlib>
 #include <map>
+#include <memory>
+#include <random>
+#include <vector>
 
 
 // in case we want to add other minimization methods in the future.
 enum MINIMIZATION_METHOD {
-  GREEDY
+  GREEDY,
+  MULTI_START  // greedy from many starting partitions, in parallel
 };
 
 
@@ -26,19 +33,50 @@ enum MINIMIZATION_METHOD {
 class ClusterEstimator {
  private:
   LossFunction* loss_function;
-  Eigen::MatrixXi mcmc_sample; // T*N matrix
+  LOSS_FUNCTION loss_type;
+  Eigen::MatrixXi mcmc_sample; // distinct partitions of the sample, U*N
+  Eigen::VectorXi sample_counts; // multiplicity of each distinct partition
+  // the same partitions, with compact labels, for the evaluation of the EPL
+  std::unique_ptr<CompactPartitions> compact_sample;
+  // posterior similarity matrix, only for Binder loss and the VI lower bound
+  std::unique_ptr<bayesmix::SimilarityMatrix> psm;
   int T; // total time of the process
   int N;
   int K_up;
   Eigen::VectorXi initial_partition;
+
+  int n_starts = 32;          // nº of starting partitions of MULTI_START
+  double time_budget = 60.0;  // seconds, for MULTI_START
+
+  // incremental evaluation of the EPL used by the greedy algorithm
+  std::unique_ptr<IncrementalLoss> make_incremental_loss(int L) const;
+  // maps the labels of a partition to the internal labels of greedy_sweeps
+  // (with at most K clusters)
+  std::vector<int> internal_labels(const Eigen::VectorXi &a, int K) const;
+  // greedy sweeps over internal labels z with at most K clusters, until a
+  // sweep changes nothing or the deadline is reached (at least one sweep is
+  // always done); returns the nº of sweeps
+  int greedy_sweeps(std::vector<int> &z, int K, std::mt19937_64 &rng,
+                    std::chrono::steady_clock::time_point deadline) const;
  public:
+  // psm_storage and psm_threshold choose how the posterior similarity matrix
+  // used by the Binder loss is stored, see bayesmix::SimilarityStorage
   ClusterEstimator(Eigen::MatrixXi &mcmc_sample_, LOSS_FUNCTION loss_type_,
-                    int K_up, Eigen::VectorXi &initial_partition_);
+                    int K_up, Eigen::VectorXi &initial_partition_,
+                    bayesmix::SimilarityStorage psm_storage =
+                        bayesmix::SimilarityStorage::dense,
+                    float psm_threshold = 0.0f);
   ~ClusterEstimator();
-  double expected_posterior_loss(Eigen::VectorXi a);
+  // for VARIATION_INFORMATION_LOWER_BOUND, the lower bound to the VI EPL
+  double expected_posterior_loss(Eigen::VectorXi a) const;
 //  Eigen::VectorXd expected_posterior_loss_for_each_Kup(Eigen::VectorXi a);
   Eigen::VectorXi cluster_estimate(MINIMIZATION_METHOD method);
   Eigen::VectorXi greedy_algorithm(Eigen::VectorXi &a);
+  Eigen::VectorXi multi_start_algorithm();
+  void set_multi_start(int n_starts_, double time_budget_);
+  // EPL for each max number of clusters K = 1..K_up, starting from the
+  // initial partition and warm-starting from the best one found so far
+  Eigen::VectorXd epl_for_each_K(double tolerance = 0.0, int patience = 1);
 };
 
 #endif  // BAYESMIX_CLUSTERESTIMATOR_HPP
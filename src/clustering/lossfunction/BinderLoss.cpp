@@ -1,9 +1,14 @@
 #include "BinderLoss.hpp"
+#include "ContingencyTable.hpp"
 #include <iostream>
 
 using namespace std;
 
-int indicator(bool exp);
+// nº of pairs that can be formed with n points
+static double pairs(int n)
+{
+  return 0.5 * n * (n - 1);
+}
 
 BinderLoss::BinderLoss(double l1_, double l2_) : LossFunction()
 {
@@ -14,32 +19,17 @@ BinderLoss::BinderLoss(double l1_, double l2_) : LossFunction()
 BinderLoss::~BinderLoss() {
 }
 
-double BinderLoss::Loss()
+double BinderLoss::Loss(const ContingencyTable &table) const
 {
-  double var = 0.0;
-  int size = cluster1->size();
+  // A pair of points is penalised by l1 when it is split by cluster1 but not
+  // by cluster2, and by l2 in the opposite case. Counting the pairs through
+  // the contingency table of the two partitions avoids the O(N^2) loop:
+  // sum_h C(m_h, 2) - sum_gh C(n_gh, 2) pairs are together only in cluster2
+  // and sum_g C(n_g, 2) - sum_gh C(n_gh, 2) are together only in cluster1.
 
-  for (int i = 0; i < size; i++)
-  {
-    for (int j = i + 1; j < size; j++)
-    {
-      var += l1 * indicator((*cluster1)(i) != (*cluster1)(j)) * indicator((*cluster2)(i) == (*cluster2)(j)) +
-             l2 * indicator((*cluster1)(i) == (*cluster1)(j)) * indicator((*cluster2)(i) != (*cluster2)(j));
-    }
-  }
+  double together_both = table.SumOverCells(pairs);
+  double together_1 = table.SumOverRows(pairs);
+  double together_2 = table.SumOverCols(pairs);
 
-  return var;
+  return l1 * (together_2 - together_both) + l2 * (together_1 - together_both);
 }
-
-
-int indicator(bool exp)
-{
-  if (exp)
-  {
-    return 1;
-  }
-  else
-  {
-    return 0;
-  }
-}
\ No newline at end of file
@@ -14,6 +14,9 @@ class BinderLoss : public LossFunction
   ~BinderLoss();
   BinderLoss() : BinderLoss(1, 1) {};
   BinderLoss(double l1_, double l2_);
-  double Loss();
+  double GetL1() const { return l1; }
+  double GetL2() const { return l2; }
+  using LossFunction::Loss;
+  double Loss(const ContingencyTable &table) const;
 };
 #endif
\ No newline at end of file
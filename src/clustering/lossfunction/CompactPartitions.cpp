@@ -0,0 +1,37 @@
+#include "CompactPartitions.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include "ContingencyTable.hpp"
+
+CompactPartitions::CompactPartitions(const Eigen::MatrixXi &sample)
+{
+  T = sample.rows();
+  N = sample.cols();
+  labels.resize((long)T * N);
+  K.resize(T);
+
+#pragma omp parallel
+  {
+    vector<int> row, lookup;
+#pragma omp for schedule(dynamic)
+    for (int t = 0; t < T; t++)
+    {
+      K[t] = ContingencyTable::CompactLabels(sample.row(t).transpose(), row,
+                                             lookup);
+      copy(row.begin(), row.end(), labels.begin() + (long)t * N);
+    }
+  }
+
+  if (GetMaxNumberOfGroups() - 1 <= numeric_limits<SmallLabel>::max())
+  {
+    small_labels.assign(labels.begin(), labels.end());
+    vector<int>().swap(labels);
+  }
+}
+
+int CompactPartitions::GetMaxNumberOfGroups() const
+{
+  return K.empty() ? 0 : *max_element(K.begin(), K.end());
+}
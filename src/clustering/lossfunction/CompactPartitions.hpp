@@ -0,0 +1,57 @@
+#ifndef COMPACTPARTITIONSHEADER
+#define COMPACTPARTITIONSHEADER
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// !Label type used when every partition has at most 65536 groups
+typedef uint16_t SmallLabel;
+
+// !This class stores a sample of partitions (one per row of a T*N matrix)
+// !with the labels of each partition compacted to 0..K_t-1, together with
+// !K_t. It is computed once per sample, so that the loss of any partition
+// !against each sample only needs to build a contingency table, whose size
+// !only depends on the actual K_t. Labels are stored in 16 bits whenever all
+// !the K_t allow it (i.e. in practice), which divides by two the memory
+// !traffic of the loss kernels.
+
+class CompactPartitions
+{
+ private:
+  int T;                          // nº of partitions
+  int N;                          // nº of points
+  vector<int> labels;             // compact labels, partition-major: [t*N + i]
+  vector<SmallLabel> small_labels;  // the same, if every K_t <= 65536
+  vector<int> K;                  // nº of groups of each partition
+
+ public:
+  CompactPartitions(const Eigen::MatrixXi &sample);
+
+  int GetSize() const { return T; }
+  int GetLength() const { return N; }
+  int GetNumberOfGroups(int t) const { return K[t]; }
+  int GetMaxNumberOfGroups() const;
+  bool HasSmallLabels() const { return labels.empty(); }
+
+  // calls f with a pointer to the N labels of partition t, either
+  // const SmallLabel * or const int *
+  template <typename F>
+  void VisitLabels(int t, F f) const {
+    if (HasSmallLabels()) {
+      f(small_labels.data() + (long)t * N);
+    } else {
+      f(labels.data() + (long)t * N);
+    }
+  }
+
+  // label of point i in partition t
+  int GetLabel(int t, int i) const {
+    long k = (long)t * N + i;
+    return HasSmallLabels() ? (int)small_labels[k] : labels[k];
+  }
+};
+
+#endif
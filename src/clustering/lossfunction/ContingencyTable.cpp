@@ -0,0 +1,69 @@
+#include "ContingencyTable.hpp"
+
+#include <stdexcept>
+#include <unordered_map>
+
+ContingencyTable::ContingencyTable(LabelsRef cluster1, LabelsRef cluster2)
+{
+  if (cluster1.size() != cluster2.size())
+  {
+    throw std::domain_error("Clusters of different sizes!");
+  }
+
+  vector<int> labels1, labels2;
+  int K1_ = CompactLabels(cluster1, labels1);
+  int K2_ = CompactLabels(cluster2, labels2);
+  Build(labels1.data(), K1_, labels2.data(), K2_, (int) cluster1.size());
+}
+
+int ContingencyTable::CompactLabels(LabelsRef cluster, vector<int> &labels)
+{
+  vector<int> lookup;
+  return CompactLabels(cluster, labels, lookup);
+}
+
+int ContingencyTable::CompactLabels(LabelsRef cluster, vector<int> &labels,
+                                    vector<int> &lookup)
+{
+  int n = (int) cluster.size();
+  labels.resize(n);
+  if (n == 0)
+  {
+    return 0;
+  }
+
+  int min = cluster.minCoeff();
+  int max = cluster.maxCoeff();
+  int K = 0;
+
+  // labels are usually in 0..N or 1..N: use a direct lookup table when the
+  // range is small, a hash map otherwise
+  if ((long) max - min < 4L * n)
+  {
+    lookup.assign(max - min + 1, -1);
+    for (int i = 0; i < n; i++)
+    {
+      int &l = lookup[cluster(i) - min];
+      if (l < 0)
+      {
+        l = K++;
+      }
+      labels[i] = l;
+    }
+  }
+  else
+  {
+    unordered_map<int, int> hash;
+    for (int i = 0; i < n; i++)
+    {
+      auto it = hash.emplace(cluster(i), K);
+      if (it.second)
+      {
+        K++;
+      }
+      labels[i] = it.first->second;
+    }
+  }
+
+  return K;
+}
@@ -0,0 +1,163 @@
+#ifndef CONTINGENCYTABLEHEADER
+#define CONTINGENCYTABLEHEADER
+
+#include <Eigen/Dense>
+#include <vector>
+
+using namespace std;
+
+// !Labels of a partition: a vector, or a row or column of a matrix, without
+// !copying it
+typedef Eigen::Ref<const Eigen::VectorXi, 0, Eigen::InnerStride<>> LabelsRef;
+
+// !This class implements the contingency table of two partitions (clusters).
+// !Labels are compacted to 0..K-1 on construction and only the nonzero cells
+// !are kept, so that building the table and summing over it costs O(N)
+// !regardless of the values of the labels and of K1*K2.
+// !A table can also be used as a workspace: Build() refills it from labels
+// !that are already compact, reusing its buffers, so that once they have
+// !grown to size no memory is allocated.
+
+class ContingencyTable
+{
+ private:
+  int K1;                  // nº of groups in the first partition
+  int K2;                  // nº of groups in the second partition
+  int N;                   // nº of points
+  vector<int> row_counts;  // n_g, size K1
+  vector<int> col_counts;  // m_h, size K2
+  vector<int> cells;       // nonzero n_gh, in no particular order
+  // workspace
+  vector<int> dense;       // all the n_gh, when K1*K2 is small
+  vector<int> order;       // points sorted by group of the first partition
+  vector<int> start;       // first position of each group in "order"
+  vector<int> scratch;     // counts of the second labels inside one group
+  vector<int> touched;     // nonzero entries of "scratch"
+
+ public:
+  ContingencyTable() : K1(0), K2(0), N(0) {};
+  ContingencyTable(LabelsRef cluster1, LabelsRef cluster2);
+
+  // refills the table from compact labels (in 0..K1-1 and 0..K2-1), of any
+  // integer type
+  template <typename Label1, typename Label2>
+  void Build(const Label1 *labels1, int K1_, const Label2 *labels2, int K2_,
+             int N_);
+
+  // relabels "cluster" to 0..K-1 (in order of appearance) inside "labels"
+  // and returns K; "lookup" is a workspace
+  static int CompactLabels(LabelsRef cluster, vector<int> &labels,
+                           vector<int> &lookup);
+  static int CompactLabels(LabelsRef cluster, vector<int> &labels);
+
+  int GetRows() const { return K1; }
+  int GetCols() const { return K2; }
+  int GetSize() const { return N; }
+  int GetNumberOfCells() const { return (int)cells.size(); }
+  int RowCount(int g) const { return row_counts[g]; }
+  int ColCount(int h) const { return col_counts[h]; }
+
+  // sum of f(n_gh) over the nonzero cells of the table
+  template <typename F>
+  double SumOverCells(F f) const {
+    double sum = 0.0;
+    for (int n : cells) {
+      sum += f(n);
+    }
+    return sum;
+  }
+
+  // sum of f(n_g) over the groups of the first partition
+  template <typename F>
+  double SumOverRows(F f) const {
+    double sum = 0.0;
+    for (int n : row_counts) {
+      sum += f(n);
+    }
+    return sum;
+  }
+
+  // sum of f(m_h) over the groups of the second partition
+  template <typename F>
+  double SumOverCols(F f) const {
+    double sum = 0.0;
+    for (int n : col_counts) {
+      sum += f(n);
+    }
+    return sum;
+  }
+};
+
+template <typename Label1, typename Label2>
+void ContingencyTable::Build(const Label1 *labels1, int K1_,
+                             const Label2 *labels2, int K2_, int N_)
+{
+  K1 = K1_;
+  K2 = K2_;
+  N = N_;
+
+  row_counts.assign(K1, 0);
+  col_counts.assign(K2, 0);
+  for (int i = 0; i < N; i++)
+  {
+    row_counts[labels1[i]]++;
+    col_counts[labels2[i]]++;
+  }
+  cells.clear();
+
+  // At most N cells are nonzero: a dense table is only worth filling when
+  // K1*K2 is of the same order as N
+  if ((long) K1 * K2 <= 4L * N)
+  {
+    dense.assign(K1 * K2, 0);
+    for (int i = 0; i < N; i++)
+    {
+      dense[labels1[i] * K2 + labels2[i]]++;
+    }
+    for (int n : dense)
+    {
+      if (n > 0)
+      {
+        cells.push_back(n);
+      }
+    }
+    return;
+  }
+
+  // Otherwise the points are sorted by their first label, and the cells of
+  // each row are counted in a scratch vector of size K2
+  start.resize(K1 + 1);
+  start[0] = 0;
+  for (int g = 0; g < K1; g++)
+  {
+    start[g + 1] = start[g] + row_counts[g];
+  }
+  order.resize(N);
+  for (int i = 0; i < N; i++)
+  {
+    order[start[labels1[i]]++] = i;
+  }
+  // start[g] now points to the end of group g
+  scratch.assign(K2, 0);
+  int first = 0;
+  for (int g = 0; g < K1; g++)
+  {
+    for (int p = first; p < start[g]; p++)
+    {
+      int h = labels2[order[p]];
+      if (scratch[h]++ == 0)
+      {
+        touched.push_back(h);
+      }
+    }
+    for (int h : touched)
+    {
+      cells.push_back(scratch[h]);
+      scratch[h] = 0;
+    }
+    touched.clear();
+    first = start[g];
+  }
+}
+
+#endif
@@ -0,0 +1,385 @@
+#include "IncrementalLoss.hpp"
+
+#include <cmath>
+
+#include "ContingencyTable.hpp"
+
+BinderIncrementalLoss::BinderIncrementalLoss(
+    const bayesmix::SimilarityMatrix &psm_, double l1_, double l2_, int L_)
+    : IncrementalLoss(psm_.size(), L_), psm(psm_), l1(l1_), l2(l2_)
+{
+  sizes.resize(L);
+  weights.resize(L);
+}
+
+void BinderIncrementalLoss::Initialize(const vector<int> &z_)
+{
+  z = z_;
+  fill(sizes.begin(), sizes.end(), 0);
+  for (int l : z)
+  {
+    if (l < L)
+    {
+      sizes[l]++;
+    }
+  }
+}
+
+void BinderIncrementalLoss::Remove(int i)
+{
+  if (z[i] < L)
+  {
+    sizes[z[i]]--;
+  }
+  z[i] = -1;
+}
+
+void BinderIncrementalLoss::InsertionCosts(int i,
+                                           const vector<int> &candidates,
+                                           vector<double> &costs)
+{
+  // pairs (i, j) with j outside the candidate groups are split whatever the
+  // choice, so that they only add a constant to the costs
+  fill(weights.begin(), weights.end(), 0.0);
+  psm.accumulate_row(i, z, weights);
+
+  costs.resize(candidates.size());
+  for (size_t k = 0; k < candidates.size(); k++)
+  {
+    int s = candidates[k];
+    costs[k] = l2 * sizes[s] - (l1 + l2) * weights[s];
+  }
+}
+
+void BinderIncrementalLoss::Insert(int i, int s)
+{
+  sizes[s]++;
+  z[i] = s;
+}
+
+
+VIIncrementalLoss::VIIncrementalLoss(const CompactPartitions &sample,
+                                     const Eigen::VectorXi &counts_,
+                                     bool normalise_, int L_)
+    : IncrementalLoss(sample.GetLength(), L_),
+      normalise(normalise_)
+{
+  T = sample.GetSize();
+  double total = counts_.sum();
+  weights.resize(T);
+  for (int t = 0; t < T; t++)
+  {
+    weights[t] = counts_(t) / total;
+  }
+
+  xlogx.resize(N + 2);
+  for (int n = 0; n < N + 2; n++)
+  {
+    xlogx[n] = n > 0 ? n * log2((double)n) : 0.0;
+  }
+
+  // The labels of every sample are compact, so that the contingency counts of
+  // sample t fit in a K_t*L table. They are transposed to datum-major order,
+  // in 16 bits when possible
+  if (sample.HasSmallLabels())
+  {
+    small_sample_labels.resize((long)N * T);
+  }
+  else
+  {
+    sample_labels.resize((long)N * T);
+  }
+  K.resize(T);
+  offsets.resize(T + 1);
+  S_sample.resize(T);
+  offsets[0] = 0;
+  vector<int> counts;
+  for (int t = 0; t < T; t++)
+  {
+    K[t] = sample.GetNumberOfGroups(t);
+    counts.assign(K[t], 0);
+    for (int i = 0; i < N; i++)
+    {
+      int h = sample.GetLabel(t, i);
+      if (sample.HasSmallLabels())
+      {
+        small_sample_labels[(long)i * T + t] = h;
+      }
+      else
+      {
+        sample_labels[(long)i * T + t] = h;
+      }
+      counts[h]++;
+    }
+    S_sample[t] = 0.0;
+    for (int n : counts)
+    {
+      S_sample[t] += xlogx[n];
+    }
+    offsets[t + 1] = offsets[t] + (long)K[t] * L;
+  }
+
+  joint.resize(offsets[T]);
+  overflow.resize(T);
+  S_joint.resize(T);
+}
+
+int &VIIncrementalLoss::Cell(int t, int h, int l)
+{
+  if (l < L)
+  {
+    return joint[offsets[t] + (long)h * L + l];
+  }
+  return overflow[t][(long)(l - L) * K[t] + h];
+}
+
+double VIIncrementalLoss::SampleLoss(int t, double S_a, double S_ac) const
+{
+  double vi = (S_a + S_sample[t] - 2 * S_ac) / N;
+  if (!normalise)
+  {
+    return vi;
+  }
+  // VI divided by the joint entropy, that is zero only when both partitions
+  // are made of a single group
+  double joint_entropy = log2((double)N) - S_ac / N;
+  return joint_entropy > 1.0e-12 ? vi / joint_entropy : 0.0;
+}
+
+void VIIncrementalLoss::Initialize(const vector<int> &z_)
+{
+  z = z_;
+
+  int n_labels = L;
+  for (int l : z)
+  {
+    n_labels = max(n_labels, l + 1);
+  }
+  sizes.assign(n_labels, 0);
+  for (int l : z)
+  {
+    sizes[l]++;
+  }
+  S_partition = 0.0;
+  for (int n : sizes)
+  {
+    S_partition += xlogx[n];
+  }
+
+  fill(joint.begin(), joint.end(), 0);
+  for (int t = 0; t < T; t++)
+  {
+    overflow[t].clear();
+    for (int i = 0; i < N; i++)
+    {
+      VisitSampleLabels(i, [&](const auto *h) { Cell(t, h[t], z[i])++; });
+    }
+
+    S_joint[t] = 0.0;
+    for (long c = offsets[t]; c < offsets[t + 1]; c++)
+    {
+      S_joint[t] += xlogx[joint[c]];
+    }
+    for (auto &cell : overflow[t])
+    {
+      S_joint[t] += xlogx[cell.second];
+    }
+  }
+}
+
+void VIIncrementalLoss::Remove(int i)
+{
+  int r = z[i];
+  S_partition += xlogx[sizes[r] - 1] - xlogx[sizes[r]];
+  sizes[r]--;
+
+  VisitSampleLabels(i, [&](const auto *h) {
+    for (int t = 0; t < T; t++)
+    {
+      int &c = Cell(t, h[t], r);
+      S_joint[t] += xlogx[c - 1] - xlogx[c];
+      c--;
+    }
+  });
+  z[i] = -1;
+}
+
+void VIIncrementalLoss::InsertionCosts(int i, const vector<int> &candidates,
+                                       vector<double> &costs)
+{
+  int n_cand = candidates.size();
+  costs.assign(n_cand, 0.0);
+  S_candidate.resize(n_cand);
+  for (int k = 0; k < n_cand; k++)
+  {
+    int n = sizes[candidates[k]];
+    S_candidate[k] = S_partition + xlogx[n + 1] - xlogx[n];
+  }
+
+  VisitSampleLabels(i, [&](const auto *h) {
+    for (int t = 0; t < T; t++)
+    {
+      const int *cells = &joint[offsets[t] + (long)h[t] * L];
+      for (int k = 0; k < n_cand; k++)
+      {
+        int c = cells[candidates[k]];
+        double S_ac = S_joint[t] + xlogx[c + 1] - xlogx[c];
+        costs[k] += weights[t] * SampleLoss(t, S_candidate[k], S_ac);
+      }
+    }
+  });
+}
+
+void VIIncrementalLoss::Insert(int i, int s)
+{
+  S_partition += xlogx[sizes[s] + 1] - xlogx[sizes[s]];
+  sizes[s]++;
+
+  VisitSampleLabels(i, [&](const auto *h) {
+    for (int t = 0; t < T; t++)
+    {
+      int &c = Cell(t, h[t], s);
+      S_joint[t] += xlogx[c + 1] - xlogx[c];
+      c++;
+    }
+  });
+  z[i] = s;
+}
+
+
+VILowerBoundIncrementalLoss::VILowerBoundIncrementalLoss(
+    const bayesmix::SimilarityMatrix &psm_, int L_)
+    : IncrementalLoss(psm_.size(), L_), psm(psm_), row_index(-1)
+{
+  S.resize(N);
+  sums.resize(L);
+  gains.resize(L);
+}
+
+const vector<float> &VILowerBoundIncrementalLoss::Row(int i)
+{
+  if (row_index != i)
+  {
+    psm.get_row(i, row);
+    row_index = i;
+  }
+  return row;
+}
+
+void VILowerBoundIncrementalLoss::Initialize(const vector<int> &z_)
+{
+  z = z_;
+  int n_labels = L;
+  for (int l : z)
+  {
+    n_labels = max(n_labels, l + 1);
+  }
+  sizes.assign(n_labels, 0);
+  for (int l : z)
+  {
+    sizes[l]++;
+  }
+
+  for (int n = 0; n < N; n++)
+  {
+    const vector<float> &p = Row(n);
+    S[n] = 0.0;
+    for (int m = 0; m < N; m++)
+    {
+      if (z[m] == z[n])
+      {
+        S[n] += p[m];
+      }
+    }
+  }
+}
+
+void VILowerBoundIncrementalLoss::Remove(int i)
+{
+  int r = z[i];
+  const vector<float> &p = Row(i);
+  for (int n = 0; n < N; n++)
+  {
+    if (z[n] == r && n != i)
+    {
+      S[n] -= p[n];
+    }
+  }
+  sizes[r]--;
+  z[i] = -1;
+}
+
+void VILowerBoundIncrementalLoss::InsertionCosts(
+    int i, const vector<int> &candidates, vector<double> &costs)
+{
+  // only the terms of i and of the members of the chosen group change
+  const vector<float> &p = Row(i);
+  fill(sums.begin(), sums.end(), 0.0);
+  fill(gains.begin(), gains.end(), 0.0);
+  for (int n = 0; n < N; n++)
+  {
+    int l = z[n];
+    if (l >= 0 && l < L && p[n] > 0)
+    {
+      sums[l] += p[n];
+      gains[l] += log2(1.0 + p[n] / S[n]);
+    }
+  }
+
+  costs.resize(candidates.size());
+  for (size_t k = 0; k < candidates.size(); k++)
+  {
+    int s = candidates[k];
+    double n = sizes[s];
+    double size_term = (n + 1) * log2(n + 1) - (n > 0 ? n * log2(n) : 0.0);
+    costs[k] = (size_term - 2 * (log2(1.0 + sums[s]) + gains[s])) / N;
+  }
+}
+
+void VILowerBoundIncrementalLoss::Insert(int i, int s)
+{
+  const vector<float> &p = Row(i);
+  S[i] = 1.0;
+  for (int n = 0; n < N; n++)
+  {
+    if (z[n] == s)
+    {
+      S[n] += p[n];
+      S[i] += p[n];
+    }
+  }
+  sizes[s]++;
+  z[i] = s;
+}
+
+double VILowerBoundIncrementalLoss::LowerBound(
+    const bayesmix::SimilarityMatrix &psm, const Eigen::VectorXi &cluster)
+{
+  int N = psm.size();
+  vector<int> labels;
+  int K = ContingencyTable::CompactLabels(cluster, labels);
+  vector<int> sizes(K, 0);
+  for (int l : labels)
+  {
+    sizes[l]++;
+  }
+
+  double bound = 0.0;
+  vector<float> p;
+  for (int n = 0; n < N; n++)
+  {
+    psm.get_row(n, p);
+    double within = 0.0;
+    double total = 0.0;
+    for (int m = 0; m < N; m++)
+    {
+      total += p[m];
+      if (labels[m] == labels[n])
+      {
+        within += p[m];
+      }
+    }
+    bound += log2((double)sizes[labels[n]]) - 2 * log2(within) + log2(total);
+  }
+  return bound / N;
+}
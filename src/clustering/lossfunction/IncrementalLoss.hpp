@@ -0,0 +1,150 @@
+#ifndef INCREMENTALLOSSHEADER
+#define INCREMENTALLOSSHEADER
+
+#include <Eigen/Dense>
+#include <unordered_map>
+#include <vector>
+
+#include "CompactPartitions.hpp"
+#include "src/utils/cluster_utils.h"
+
+using namespace std;
+
+// !This class evaluates the expected posterior loss (EPL) of a partition
+// !incrementally, while the greedy algorithm relabels one datum at a time.
+// !The partition is given as internal labels z in 0..L-1 (the candidate
+// !groups); labels >= L are groups of the starting partition that are only
+// !allowed to shrink. A datum is first removed from its group (it then forms
+// !a group of its own), then the EPL of inserting it into each candidate group
+// !is evaluated, and finally it is inserted into the chosen group.
+// !Each object holds the state of a single optimization run.
+
+class IncrementalLoss
+{
+ protected:
+  vector<int> z;  // current internal labels, -1 while a datum is removed
+  int L;          // nº of candidate groups
+  int N;          // nº of points
+
+ public:
+  IncrementalLoss(int N_, int L_) : L(L_), N(N_) {};
+  virtual ~IncrementalLoss() {};
+
+  // rebuilds the whole state from the given labeling
+  virtual void Initialize(const vector<int> &z_) = 0;
+  // removes datum i from its group
+  virtual void Remove(int i) = 0;
+  // fills costs[k] with the EPL (up to a constant shared by all candidates)
+  // of inserting datum i into group candidates[k] (each < L)
+  virtual void InsertionCosts(int i, const vector<int> &candidates,
+                              vector<double> &costs) = 0;
+  // inserts the removed datum i into group s
+  virtual void Insert(int i, int s) = 0;
+};
+
+// !Binder loss: the EPL only depends on the posterior similarity matrix
+// !(PSM), and inserting datum i into group s costs
+// !l2 * n_s - (l1 + l2) * sum_{j in s} psm(i, j), i.e. one pass over the
+// !stored entries of row i: a sparse PSM only visits its nonzero entries.
+
+class BinderIncrementalLoss : public IncrementalLoss
+{
+ private:
+  const bayesmix::SimilarityMatrix &psm;
+  double l1;
+  double l2;
+  vector<int> sizes;       // sizes of the candidate groups
+  vector<double> weights;  // workspace, one entry per candidate group
+
+ public:
+  BinderIncrementalLoss(const bayesmix::SimilarityMatrix &psm_, double l1_,
+                        double l2_, int L_);
+  void Initialize(const vector<int> &z_);
+  void Remove(int i);
+  void InsertionCosts(int i, const vector<int> &candidates,
+                      vector<double> &costs);
+  void Insert(int i, int s);
+};
+
+// !Variation of information: with S(x) = sum_k n_k log2(n_k) over the group
+// !sizes of x, VI(a, c) = (S(a) + S(c) - 2 S(a, c)) / N. For every MCMC
+// !sample the contingency counts with the current partition are kept, so that
+// !moving a datum updates S(a) and each S(a, c_t) in O(1). Samples can be
+// !weighted by their multiplicities (see bayesmix::unique_partitions).
+
+class VIIncrementalLoss : public IncrementalLoss
+{
+ private:
+  bool normalise;
+  int T;
+  vector<double> weights;     // weight of each sample, summing to 1
+  vector<int> sample_labels;  // compacted labels, datum-major: [i*T + t]
+  vector<SmallLabel> small_sample_labels;  // the same in 16 bits, if possible
+  vector<int> K;              // nº of groups of each sample
+  vector<long> offsets;       // offset of each sample's table in "joint"
+  vector<int> joint;          // counts n_{l,h}, stored as [h*L + l]
+  vector<unordered_map<long, int>> overflow;  // counts for labels >= L
+  vector<int> sizes;          // group sizes of the current partition
+  vector<double> S_sample;    // S(c_t)
+  vector<double> S_joint;     // S(a, c_t)
+  double S_partition;         // S(a)
+  vector<double> xlogx;       // n*log2(n), for n = 0..N
+  vector<double> S_candidate;  // workspace, one entry per candidate
+
+  int &Cell(int t, int h, int l);
+  // calls f with a pointer to the T labels of datum i in the samples
+  template <typename F>
+  void VisitSampleLabels(int i, F f) const {
+    if (small_sample_labels.empty()) {
+      f(&sample_labels[(long)i * T]);
+    } else {
+      f(&small_sample_labels[(long)i * T]);
+    }
+  }
+  double SampleLoss(int t, double S_a, double S_ac) const;
+
+ public:
+  VIIncrementalLoss(const CompactPartitions &sample,
+                    const Eigen::VectorXi &counts_, bool normalise_, int L_);
+  void Initialize(const vector<int> &z_);
+  void Remove(int i);
+  void InsertionCosts(int i, const vector<int> &candidates,
+                      vector<double> &costs);
+  void Insert(int i, int s);
+};
+
+// !Lower bound to the VI expected posterior loss (Wade and Ghahramani, 2018),
+// !obtained from Jensen's inequality: with p the PSM (p_nn = 1),
+// !  E[VI(a, c)] >= 1/N sum_n [ log2 sum_m 1(a_m = a_n)
+// !                             - 2 log2 sum_m 1(a_m = a_n) p_nm
+// !                             + log2 sum_m p_nm ].
+// !Only the PSM is needed: the inner sums S_n = sum_{m in a_n} p_nm are kept
+// !for every datum, so that moving a datum costs one pass over its PSM row.
+
+class VILowerBoundIncrementalLoss : public IncrementalLoss
+{
+ private:
+  const bayesmix::SimilarityMatrix &psm;
+  vector<int> sizes;       // group sizes of the current partition
+  vector<double> S;        // S_n = sum_{m in a_n} p_nm, including m = n
+  vector<float> row;       // workspace: row "row_index" of the PSM
+  int row_index;
+  vector<double> sums;     // workspace, one entry per candidate group
+  vector<double> gains;    // workspace, one entry per candidate group
+
+  const vector<float> &Row(int i);
+
+ public:
+  VILowerBoundIncrementalLoss(const bayesmix::SimilarityMatrix &psm_, int L_);
+  void Initialize(const vector<int> &z_);
+  void Remove(int i);
+  void InsertionCosts(int i, const vector<int> &candidates,
+                      vector<double> &costs);
+  void Insert(int i, int s);
+
+  // value of the lower bound for the partition "cluster"
+  static double LowerBound(const bayesmix::SimilarityMatrix &psm,
+                           const Eigen::VectorXi &cluster);
+};
+
+#endif
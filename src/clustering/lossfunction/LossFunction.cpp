@@ -1,19 +1,14 @@
 #include "LossFunction.hpp"
 #include <iostream>
 
-LossFunction::LossFunction() : cluster1(0), cluster2(0) {
-  cluster1 = new Eigen::VectorXi();
-  cluster2 = new Eigen::VectorXi();
+LossFunction::LossFunction() : K1(0), K2(0), N(0) {
 }
 
 LossFunction::~LossFunction() {
-  delete cluster1;
-  delete cluster2;
 }
 
 
-void LossFunction::SetCluster(Eigen::VectorXi cluster1_,
-                              Eigen::VectorXi cluster2_)
+void LossFunction::SetCluster(LabelsRef cluster1_, LabelsRef cluster2_)
 {
   auto n_rows = cluster1_.rows();
 
@@ -24,73 +19,106 @@ void LossFunction::SetCluster(Eigen::VectorXi cluster1_,
 
   N = (int) n_rows;
 
-  *cluster1 = cluster1_;
+  cluster1 = cluster1_;
   K1 = GetNumberOfGroups(cluster1_);
-  *cluster2 = cluster2_;
+  cluster2 = cluster2_;
   K2 = GetNumberOfGroups(cluster2_);
 }
 
-void LossFunction::SetFirstCluster(Eigen::VectorXi cluster1_)
+void LossFunction::SetFirstCluster(LabelsRef cluster1_)
 {
   N = cluster1_.rows();
-  *cluster1 = cluster1_;
+  cluster1 = cluster1_;
   K1 = GetNumberOfGroups(cluster1_);
 }
 
-void LossFunction::SetSecondCluster(Eigen::VectorXi cluster2_) {
+void LossFunction::SetSecondCluster(LabelsRef cluster2_) {
   N = cluster2_.rows();
-  *cluster2 = cluster2_;
+  cluster2 = cluster2_;
   K2 = GetNumberOfGroups(cluster2_);
 }
 
-Eigen::VectorXi * LossFunction::GetCluster(int i) const {
+const Eigen::VectorXi * LossFunction::GetCluster(int i) const {
   switch(i) {
-    case 1 : return cluster1;
-    case 2: return cluster2;
+    case 1 : return &cluster1;
+    case 2: return &cluster2;
     default : throw std::domain_error("Wrong cluster index.");
   }
 }
 
 
-int LossFunction::GetNumberOfGroups(Eigen::VectorXi cluster)
+double LossFunction::Loss()
 {
-  std::set<int> groups;
+  return Loss(cluster1, cluster2);
+}
 
-  for (int i = 0; i < cluster.rows(); i++)
+double LossFunction::Loss(LabelsRef cluster1_, LabelsRef cluster2_) const
+{
+  if (cluster1_.size() != cluster2_.size())
   {
-    groups.insert(cluster(i));
+    throw std::domain_error("Clusters of different sizes!");
   }
-
-  return (int)groups.size();
+  // one workspace per thread, whose buffers are reused across calls
+  static thread_local ContingencyTable table;
+  static thread_local vector<int> labels1, labels2, lookup;
+  int K1_ = ContingencyTable::CompactLabels(cluster1_, labels1, lookup);
+  int K2_ = ContingencyTable::CompactLabels(cluster2_, labels2, lookup);
+  table.Build(labels1.data(), K1_, labels2.data(), K2_,
+              (int) cluster1_.size());
+  return Loss(table);
 }
 
-int LossFunction::ClassCounter(Eigen::VectorXi cluster, int index)
+Eigen::VectorXd LossFunction::LossAgainstSample(
+    LabelsRef cluster, const CompactPartitions &sample) const
 {
-  int count = 0;
-  for (int i = 0; i < N; i++)
+  int T = sample.GetSize();
+  int n = sample.GetLength();
+  if (cluster.size() != n)
+  {
+    throw std::domain_error("Clusters of different sizes!");
+  }
+  vector<int> labels;
+  int K = ContingencyTable::CompactLabels(cluster, labels);
+  Eigen::VectorXd losses(T);
+
+#pragma omp parallel
   {
-    if (cluster(i) == index)
+    ContingencyTable table;
+#pragma omp for schedule(dynamic)
+    for (int t = 0; t < T; t++)
     {
-      count += 1;
+      sample.VisitLabels(t, [&](const auto *sample_labels) {
+        table.Build(labels.data(), K, sample_labels,
+                    sample.GetNumberOfGroups(t), n);
+      });
+      losses(t) = Loss(table);
     }
   }
 
-  return count;
+  return losses;
 }
 
-int LossFunction::ClassCounterExtended(Eigen::VectorXi cluster1, Eigen::VectorXi cluster2, int g, int h)
+Eigen::VectorXd LossFunction::LossAgainstSample(
+    LabelsRef cluster, const Eigen::MatrixXi &sample) const
 {
-  int count = 0;
+  return LossAgainstSample(cluster, CompactPartitions(sample));
+}
 
-  for (int i = 0; i < cluster1.size(); i++)
-  {
-    if (cluster1[i] == g && cluster2[i] == h)
-    {
-      count += 1;
-    }
-  }
+int LossFunction::GetNumberOfGroups(LabelsRef cluster)
+{
+  vector<int> labels;
+  return ContingencyTable::CompactLabels(cluster, labels);
+}
 
-  return count;
+int LossFunction::ClassCounter(LabelsRef cluster, int index)
+{
+  return (int)(cluster.array() == index).count();
+}
+
+int LossFunction::ClassCounterExtended(LabelsRef cluster1, LabelsRef cluster2,
+                                       int g, int h)
+{
+  return (int)((cluster1.array() == g) && (cluster2.array() == h)).count();
 }
 
 ostream &operator<<(ostream &out, LossFunction const * loss_function) {
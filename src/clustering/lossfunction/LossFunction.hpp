@@ -6,6 +6,9 @@
 #include <stdexcept>
 #include <ostream>
 
+#include "CompactPartitions.hpp"
+#include "ContingencyTable.hpp"
+
 using namespace std;
 
 // !This class implements a Loss Function for two partitions (clusters).
@@ -14,32 +17,39 @@ using namespace std;
 enum LOSS_FUNCTION {
   BINDER_LOSS,
   VARIATION_INFORMATION,
-  VARIATION_INFORMATION_NORMALIZED
+  VARIATION_INFORMATION_NORMALIZED,
+  VARIATION_INFORMATION_LOWER_BOUND  // only for point estimation, from the PSM
 };
 
 class LossFunction
 {
  protected:
-  Eigen::VectorXi * cluster1;
+  Eigen::VectorXi cluster1;
   int K1; // nº of groups in cluster1
-  Eigen::VectorXi * cluster2;
+  Eigen::VectorXi cluster2;
   int K2; // nº of groups in cluster2
   int N;  // nº of points
 
  public:
   LossFunction();
   virtual ~LossFunction() = 0;
-  void SetCluster(Eigen::VectorXi cluster1_,
-                  Eigen::VectorXi cluster2_);           // Populate the members
-  void SetFirstCluster(Eigen::VectorXi cluster1_);
-  void SetSecondCluster(Eigen::VectorXi cluster2_);
-  Eigen::VectorXi * GetCluster(int i) const; // return the i th cluster reference (i = 1 or 2)
-
-  int GetNumberOfGroups(Eigen::VectorXi cluster);       // returns the nº of groups in a cluster (ie K)
-  int ClassCounter(Eigen::VectorXi cluster, int index); // returns how many times the group "index" appears inside "cluster" (n(a,g) in the article)
-  int ClassCounterExtended(Eigen::VectorXi cluster1,
-                           Eigen::VectorXi cluster2, int g, int h); // mutual count of how many times the group "g" and "h" appear inside "cluster1" and "cluster2" simultaneously (n_{g,h} ^ (a,z) in the article)
-  virtual double Loss() = 0;                                         // Loss Function to be implemented in the extended classes.
+  void SetCluster(LabelsRef cluster1_,
+                  LabelsRef cluster2_);           // Populate the members
+  void SetFirstCluster(LabelsRef cluster1_);
+  void SetSecondCluster(LabelsRef cluster2_);
+  const Eigen::VectorXi * GetCluster(int i) const; // return the i th cluster reference (i = 1 or 2)
+
+  int GetNumberOfGroups(LabelsRef cluster);       // returns the nº of groups in a cluster (ie K)
+  int ClassCounter(LabelsRef cluster, int index); // returns how many times the group "index" appears inside "cluster" (n(a,g) in the article)
+  int ClassCounterExtended(LabelsRef cluster1,
+                           LabelsRef cluster2, int g, int h); // mutual count of how many times the group "g" and "h" appear inside "cluster1" and "cluster2" simultaneously (n_{g,h} ^ (a,z) in the article)
+  virtual double Loss(const ContingencyTable &table) const = 0; // Loss Function to be implemented in the extended classes, from the contingency table of the two clusters
+  double Loss(LabelsRef cluster1_, LabelsRef cluster2_) const; // Loss between two clusters. It does not touch the members and works in a thread-local table, hence it is thread-safe and allocation-free once warm
+  double Loss();                                                     // Loss between the two populated clusters
+  Eigen::VectorXd LossAgainstSample(LabelsRef cluster,
+                                    const CompactPartitions &sample) const; // loss of "cluster" against every partition of "sample", computed in parallel
+  Eigen::VectorXd LossAgainstSample(LabelsRef cluster,
+                                    const Eigen::MatrixXi &sample) const; // same, against every row of "sample"
   string Summarize();
 };
 
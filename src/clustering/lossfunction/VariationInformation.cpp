@@ -1,84 +1,64 @@
 #include "VariationInformation.hpp"
-#include <set>
 using namespace std;
 
+// x*log2(x), with the convention 0*log(0) = 0
+static double xlog2x(int n) {
+  return n > 0 ? n * log2((double)n) : 0.0;
+}
+
 VariationInformation::VariationInformation(bool normalise_) {
   cout << "VariationInformation Constructor" << endl;
   normalise = normalise_;
 }
 
-set<int, greater<int>> getClasses(Eigen::VectorXi &partition) {
-  set<int, greater<int>> s;
-  int size = partition.size();
-
-  for (int i = 0; i < size; i++) {
-    s.insert(partition(i));
+// With counts n_k summing to N, the entropy -sum_k (n_k/N) log2(n_k/N) can
+// be rewritten as log2(N) - sum_k n_k log2(n_k) / N, so that only the nonzero
+// counts of the contingency table are ever visited.
+void VariationInformation::Entropies(const ContingencyTable &table,
+                                     double &H1, double &H2, double &H12) {
+  double n = table.GetSize();
+  if (n == 0) {
+    H1 = H2 = H12 = 0.0;
+    return;
   }
-
-  return s;
+  double log_n = log2(n);
+  H1 = log_n - table.SumOverRows(xlog2x) / n;
+  H2 = log_n - table.SumOverCols(xlog2x) / n;
+  H12 = log_n - table.SumOverCells(xlog2x) / n;
 }
 
-double VariationInformation::Entropy(Eigen::VectorXi &cluster) {
-  double H = 0.0;
-  // int K = GetNumberOfGroups(cluster);
-  int nbr = cluster.size();
-  set<int, greater<int>> classes = getClasses(cluster);
-
-  for (auto i : classes) { // Possible optimization --> TODO: test it
-    int n = ClassCounter(cluster, i + 1);
-
-    double p = (double)n / nbr;
-
-    // x*log(x) = 0, if x = 0
-    if (fabs(p) >= 1.0e-9)  // ie p != 0
-    {
-      H += p * log2(p);
-    }
-  }
-//  for (int i = 0; i < nbr; i++) {
-//    int n = ClassCounter(cluster, i + 1);
-//
-//    double p = (double)n / nbr;
-//
-//    // x*log(x) = 0, if x = 0
-//    if (fabs(p) >= 1.0e-9)  // ie p != 0
-//    {
-//      H += p * log2(p);
-//    }
-//  }
-
-  return -H;
+double VariationInformation::Entropy(LabelsRef cluster) {
+  ContingencyTable table(cluster, cluster);
+  double H1, H2, H12;
+  Entropies(table, H1, H2, H12);
+  return H1;
 }
 
-
-
 double VariationInformation::JointEntropy() {
-  double H = 0.0;
-  for (int g = 0; g < N; g++) {
-    double tmp = 0;
-    for (int h = 0; h < N; h++) {
-      double p =
-          (double)ClassCounterExtended(*cluster1, *cluster2, 1 + g, 1 + h) / N;
-      // x*log(x) = 0, if x = 0
-      if (fabs(p) >= 1.0e-9)  // ie p != 0
-      {
-        tmp += p * log2(p);
-      }
-    }
-    H += tmp;
-  }
-
-  return -H;
+  ContingencyTable table(cluster1, cluster2);
+  double H1, H2, H12;
+  Entropies(table, H1, H2, H12);
+  return H12;
 }
 
 double VariationInformation::MutualInformation() {
-  return Entropy(*cluster1) + Entropy(*cluster2) - JointEntropy();
+  ContingencyTable table(cluster1, cluster2);
+  double H1, H2, H12;
+  Entropies(table, H1, H2, H12);
+  return H1 + H2 - H12;
 }
 
-double VariationInformation::Loss() {
+double VariationInformation::Loss(const ContingencyTable &table) const {
+  double H1, H2, H12;
+  Entropies(table, H1, H2, H12);
+
   if (!normalise) {
-    return 2 * JointEntropy() - Entropy(*cluster1) - Entropy(*cluster2);
+    return 2 * H12 - H1 - H2;
   } else {
-    return 1 - MutualInformation() / JointEntropy();
+    // both partitions made of a single group: they coincide
+    if (H12 == 0.0) {
+      return 0.0;
+    }
+    return 1 - (H1 + H2 - H12) / H12;
   }
 }
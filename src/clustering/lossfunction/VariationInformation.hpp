@@ -3,20 +3,27 @@
 
 #include <cmath>
 #include <iostream>
-#include "../../../lib/math/lib/eigen_3.3.9/Eigen/Dense"
+#include <Eigen/Dense>
 
 #include "LossFunction.hpp"
+#include "ContingencyTable.hpp"
 
 class VariationInformation : public LossFunction
 {
  private:
   bool normalise;
 
+  // entropies of the two partitions and of their joint distribution,
+  // computed in a single pass over the contingency table
+  static void Entropies(const ContingencyTable &table, double &H1,
+                        double &H2, double &H12);
+
  public:
   VariationInformation(bool normalise_);
-  double Entropy(Eigen::VectorXi &cluster);
+  double Entropy(LabelsRef cluster);
   double JointEntropy();      // This method calculates the value on the members of LossFunction directly
   double MutualInformation(); // This method calculates the value on the members of LossFunction directly
-  double Loss();
+  using LossFunction::Loss;
+  double Loss(const ContingencyTable &table) const;
 };
-#endif
\ No newline at end of file
+#endif
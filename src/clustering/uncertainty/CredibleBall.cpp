@@ -1,5 +1,9 @@
 #include "CredibleBall.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 using namespace std;
 
 CredibleBall::CredibleBall(LOSS_FUNCTION loss_type,
@@ -20,6 +24,9 @@ CredibleBall::CredibleBall(LOSS_FUNCTION loss_type,
       loss_function = new VariationInformation(true);
       break;
     }
+    case VARIATION_INFORMATION_LOWER_BOUND:
+      throw std::domain_error(
+          "The VI lower bound is not a distance between partitions");
     default:
       throw std::domain_error("Loss function not recognized");
   }
@@ -28,6 +35,17 @@ CredibleBall::CredibleBall(LOSS_FUNCTION loss_type,
   N = mcmc_sample.cols();
   alpha = alpha_;
   point_estimate = point_estimate_;
+
+  // losses and counts are only computed once per distinct partition
+  unique = bayesmix::unique_partitions(mcmc_sample);
+
+  // number of clusters of each sample, used by the vertical bounds
+  n_clusters.resize(T);
+  Eigen::VectorXi unique_clusters =
+      unique.partitions.rowwise().maxCoeff().array() + 1;
+  for (int t = 0; t < T; t++) {
+    n_clusters[t] = unique_clusters(unique.index(t));
+  }
 }
 
 CredibleBall::~CredibleBall() {
@@ -36,61 +54,42 @@ CredibleBall::~CredibleBall() {
   delete loss_function;
 }
 
-double CredibleBall::calculateRegion(double rate) {
-  // rate controls how fast the steps on the updates in the estimate of the
-  // radius of the region will behave it stops updating when the probability is
-  // greater than the the confidence level (1 - alpha)
-
-  double epsilon = 1.0;
-  double probability = 0.0;
-  double steps = 1;
-  loss_function->SetFirstCluster(point_estimate);
+double CredibleBall::calculateRegion() {
+  // the radius is the smallest epsilon such that at least (1 - alpha) * T
+  // samples are within epsilon from the point estimate, i.e. the
+  // ceil((1 - alpha) * T)-th smallest loss
   cout << "Assessing the value of the radius..."
        << "\n";
 
-  while (1) {
-    epsilon = epsilon + rate * steps;
-    cout << "Epsilon: " << epsilon << endl;
-
-    for (int i = 0; i < T; i++) {
-      Eigen::VectorXi vec;
-      vec = mcmc_sample.row(i);
-      loss_function->SetSecondCluster(vec);
-      double loss = loss_function->Loss();
-
-      if (loss <= epsilon) {
-        probability += 1;
-      }
-    }
-
-    probability /= T;
-
-    if (probability >= 1 - alpha) {
-      cout << "Probability: " << probability << endl;
-      cout << "Radius estimated: " << epsilon << endl;
-      radius = epsilon;
-      prob = probability;
-      populateCredibleSet();
-      break;
-    }
-
-    steps++;
-    probability = 0;
-  }
-
-  return epsilon;
+  // the losses against the point estimate are computed once, in parallel,
+  // and shared by the bounds
+  Eigen::VectorXd unique_losses =
+      loss_function->LossAgainstSample(point_estimate, unique.partitions);
+  losses.resize(T);
+  for (int t = 0; t < T; t++) {
+    losses(t) = unique_losses(unique.index(t));
+  }
+
+  int k = (int)ceil((1 - alpha) * T - 1e-9);
+  k = std::min(std::max(k, 1), T);
+  vector<double> sorted(losses.data(), losses.data() + T);
+  nth_element(sorted.begin(), sorted.begin() + (k - 1), sorted.end());
+  radius = sorted[k - 1];
+
+  credibleBall.clear();
+  bounds_computed = false;
+  populateCredibleSet();
+  prob = (double)credibleBall.size() / T;
+  cout << "Probability: " << prob << endl;
+  cout << "Radius estimated: " << radius << endl;
+
+  return radius;
 }
 
 void CredibleBall::populateCredibleSet() {
   // save the indexes of the clusters belonging to the credible-ball
-  loss_function->SetFirstCluster(point_estimate);
-
   for (int i = 0; i < T; i++) {
-    Eigen::VectorXi vec;
-    vec = mcmc_sample.row(i);
-    loss_function->SetSecondCluster(vec);
-
-    if (loss_function->Loss() <= radius) {
+    if (losses(i) <= radius) {
       credibleBall.insert(i);
     }
   }
@@ -103,187 +102,71 @@ void CredibleBall::populateCredibleSet() {
 
 int CredibleBall::count_cluster_row(int row) {
   // Returns the number of partitions in a specified row of the mcmc_sample
-  if (row > T) {
+  if (row < 0 or row >= T) {
     cout << "Row out of bounds!" << endl;
     return -1;
   }
 
-  set<int, greater<int>> s;
-
-  for (int i = 0; i < N; i++) {
-    int tmp = mcmc_sample(row, i);
-    s.insert(tmp);
-  }
-
-  return s.size();
+  return n_clusters[row];
 }
 
-//* clusters with min cardinality that are as distant as possible from the
-//* center
-Eigen::VectorXi CredibleBall::VerticalUpperBound() {
-  set<int, greater<int>> vec1;  // vec1 is for saving the indexes of clusters
-                                // that have min cardinality
-  Eigen::VectorXi vec2;         // vec2 is an auxiliary vector
-  set<int, greater<int>> vub;
-  int tmp1;
-  int min = INT_MAX;
-
-  // find the minimal cardinality among the clusters
-  for (auto i : credibleBall) {
-    tmp1 = count_cluster_row(i);
-    if (tmp1 <= min) {
-      min = tmp1;
-    }
-  }
-
-  // save the indexes of the clusters with min cardinality
-  for (auto i : credibleBall) {
-    if (count_cluster_row(i) == min) {
-      vec1.insert(i);
-    }
-  }
-
-  // among the clusters with min cardinality find the max distance
-  // from the point_estimate
-  double max_distance = -1.0;
-  for (auto i : vec1) {
-    // we save the row "vec(i)" of the credibleBall in vec2
-    // compute the distance, ie the loss for the corresponding row
-    loss_function->SetFirstCluster(point_estimate);
-    vec2 = mcmc_sample.row(i);
-    loss_function->SetSecondCluster(vec2);
-    double loss = loss_function->Loss();
-
-    if (loss > max_distance) {
+//* Finds the three bounds in a single pass over the credible ball:
+//* - vertical upper bound: clusters with min cardinality that are as distant
+//*   as possible from the center
+//* - vertical lower bound: clusters with max cardinality that are as distant
+//*   as possible from the center
+//* - horizontal bound: clusters in the credible ball that are more distant
+//*   from the center
+//* Members are listed by decreasing index, like the credible ball itself.
+void CredibleBall::computeBounds() {
+  int min_card = INT_MAX;
+  int max_card = -1;
+  vub_distance = vlb_distance = hb_distance = -1.0;
+  vub.clear();
+  vlb.clear();
+  hb.clear();
+
+  // keeps the members with the largest distance, after a reset if "better"
+  auto update = [](vector<int>& members, double& max_distance, int i,
+                   double loss, bool reset) {
+    if (reset or loss > max_distance) {
+      members.clear();
       max_distance = loss;
     }
-  }
-  vub_distance = max_distance;
-
-  // save the clusters that are "max_distance" far away from the point estimate
-  for (auto i : vec1) {
-    loss_function->SetFirstCluster(point_estimate);
-    vec2 = mcmc_sample.row(i);
-    loss_function->SetSecondCluster(vec2);
-    double loss = loss_function->Loss();
-
     if (loss == max_distance) {
-      vub.insert(i);
-    }
-  }
-
-  Eigen::VectorXi VUB(vub.size());  // the output
-  int aux = 0;
-  for (auto i : vub) {
-    VUB(aux) = i;
-    aux++;
-  }
-
-  return VUB;
-}
-
-//* clusters with max cardinality that are as distant as possible from the
-//* center
-Eigen::VectorXi CredibleBall::VerticalLowerBound() {
-  set<int, greater<int>> vec1;
-  Eigen::VectorXi vec2;
-  // vec1 has the indexes of the clusters with maximum cardinality in the ball
-  // vec2 is an auxiliary vector
-  set<int, greater<int>> vlb;
-  int tmp1;
-  int max = -1;
-
-  // find the maximal cardinality among the clusters
-  for (auto i : credibleBall) {
-    tmp1 = count_cluster_row(i);
-    if (tmp1 >= max) {
-      max = tmp1;
+      members.push_back(i);
     }
-  }
+  };
 
-  // save the indexes of the clusters with max cardinality
   for (auto i : credibleBall) {
-    if (count_cluster_row(i) == max) {
-      vec1.insert(i);
+    int card = n_clusters[i];
+    double loss = losses(i);
+    if (card <= min_card) {
+      update(vub, vub_distance, i, loss, card < min_card);
+      min_card = card;
     }
-  }
-
-  // among the clusters with max cardinality find the max distance
-  // from the point_estimate
-  double max_distance = -1.0;
-  for (auto i : vec1) {
-    loss_function->SetFirstCluster(point_estimate);
-    vec2 = mcmc_sample.row(i);
-    loss_function->SetSecondCluster(vec2);
-    double loss = loss_function->Loss();
-
-    if (loss > max_distance) {
-      max_distance = loss;
-    }
-  }
-  vlb_distance = max_distance;
-
-  // save the clusters that are "max_distance" far away from the point estimate
-  for (auto i : vec1) {
-    loss_function->SetFirstCluster(point_estimate);
-    vec2 = mcmc_sample.row(i);
-    loss_function->SetSecondCluster(vec2);
-    double loss = loss_function->Loss();
-
-    if (loss == max_distance) {
-      vlb.insert(i);
+    if (card >= max_card) {
+      update(vlb, vlb_distance, i, loss, card > max_card);
+      max_card = card;
     }
+    update(hb, hb_distance, i, loss, false);
   }
+  bounds_computed = true;
+}
 
-  Eigen::VectorXi VLB(vlb.size());
-  int aux = 0;
-  for (auto i : vlb) {
-    VLB(aux) = i;
-    aux++;
-  }
+Eigen::VectorXi CredibleBall::VerticalUpperBound() {
+  if (!bounds_computed) computeBounds();
+  return Eigen::Map<Eigen::VectorXi>(vub.data(), vub.size());
+}
 
-  return VLB;
+Eigen::VectorXi CredibleBall::VerticalLowerBound() {
+  if (!bounds_computed) computeBounds();
+  return Eigen::Map<Eigen::VectorXi>(vlb.data(), vlb.size());
 }
 
-//* clusters in the credible ball that are more distant from the center
 Eigen::VectorXi CredibleBall::HorizontalBound() {
-  set<int, greater<int>> hb;
-  Eigen::VectorXi vec;
-  double max_distance = -1.0;
-
-  // find the max distance among all the clusters in the credible ball
-  for (auto i : credibleBall) {
-    loss_function->SetFirstCluster(point_estimate);
-    vec = mcmc_sample.row(i);
-    loss_function->SetSecondCluster(vec);
-    double loss = loss_function->Loss();
-
-    if (loss >= max_distance) {
-      max_distance = loss;
-    }
-  }
-  hb_distance = max_distance;
-
-  // select the clusters with that distance
-  for (auto i : credibleBall) {
-    loss_function->SetFirstCluster(point_estimate);
-    vec = mcmc_sample.row(i);
-
-    loss_function->SetSecondCluster(vec);
-    double loss = loss_function->Loss();
-
-    if (loss == max_distance) {
-      hb.insert(i);
-    }
-  }
-
-  Eigen::VectorXi HB(hb.size());
-  int aux = 0;
-  for (auto i : hb) {
-    HB(aux) = i;
-    aux++;
-  }
-  return HB;
+  if (!bounds_computed) computeBounds();
+  return Eigen::Map<Eigen::VectorXi>(hb.data(), hb.size());
 }
 
 //* Writes in an external file the summary of the credible ball computation
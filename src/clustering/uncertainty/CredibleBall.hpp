@@ -1,14 +1,18 @@
 #ifndef CREDIBLE_BALL_HPP
 #define CREDIBLE_BALL_HPP
 
+#include <climits>
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <set>
+#include <vector>
 
 #include <Eigen/Dense>
 #include "../lossfunction/LossFunction.hpp"
 #include "../lossfunction/BinderLoss.hpp"
 #include "../lossfunction/VariationInformation.hpp"
+#include "src/utils/cluster_utils.h"
 
 
 class CredibleBall {
@@ -26,18 +30,27 @@ class CredibleBall {
   double vlb_distance;  // distance to the vertical lower bounds
   double vub_distance;  // distance to the vertical upper bounds
   double hb_distance;   // distance to the horizontal bounds
+  Eigen::VectorXd losses;  // distance of each sample to the point estimate
+  bayesmix::UniquePartitions unique;  // distinct partitions of the sample
+  vector<int> n_clusters;  // number of clusters of each sample
+  vector<int> vub, vlb, hb;  // indexes of the members of the bounds
+  bool bounds_computed = false;
+
+  void computeBounds();  // finds the three bounds at once
+  // populate the credibleBall, from the losses and the radius computed by
+  // calculateRegion()
+  void populateCredibleSet();
 
  public:
   CredibleBall(LOSS_FUNCTION loss_type_, Eigen::MatrixXi& mcmc_sample_,
                double alpha_, Eigen::VectorXi& point_estimate_);
   ~CredibleBall();
 
-  double calculateRegion(double rate);   // calculate the radius
+  double calculateRegion();              // calculate the radius
   Eigen::VectorXi VerticalUpperBound();  // index of cluusters of the VUB
   Eigen::VectorXi VerticalLowerBound();  // index of the clusters of the VLB
   Eigen::VectorXi HorizontalBound();     // index of the clusters of the HB
 
-  void populateCredibleSet();  // populate the credibleBall
   int count_cluster_row(int index);
   void sumary(
       Eigen::VectorXi HB, Eigen::VectorXi VUB, Eigen::VectorXi VLB,
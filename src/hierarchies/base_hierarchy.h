@@ -57,6 +57,9 @@ class BaseHierarchy {
   virtual bool is_dependent() const { return false; }
   //! Returns true if the hierarchy is conjugate i.e. has a marginal lpdf
   virtual bool is_conjugate() const { return true; }
+  //! Returns true if the hyperparameters are fixed, i.e. if update_hypers()
+  //! never changes them
+  virtual bool has_fixed_hypers() const { return false; }
 
   virtual void update_hypers(
       const std::vector<bayesmix::MarginalState::ClusterState> &states) = 0;
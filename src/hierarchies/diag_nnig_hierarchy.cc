@@ -0,0 +1,224 @@
+#include "diag_nnig_hierarchy.h"
+
+#include <google/protobuf/stubs/casts.h>
+
+#include <Eigen/Dense>
+#include <stan/math/prim/prob.hpp>
+
+#include "hierarchy_prior.pb.h"
+#include "ls_state.pb.h"
+#include "marginal_state.pb.h"
+#include "src/utils/distributions.h"
+#include "src/utils/proto_utils.h"
+#include "src/utils/rng.h"
+
+void DiagNNIGHierarchy::initialize() {
+  if (prior == nullptr) {
+    throw std::invalid_argument("Hierarchy prior was not provided");
+  }
+  state.mean = hypers->mean;
+  set_var_and_utilities(hypers->scale / (hypers->shape + 1));
+  clear_data();
+}
+
+void DiagNNIGHierarchy::set_var_and_utilities(const Eigen::VectorXd &var_) {
+  state.var = var_;
+  prec = state.var.array().inverse();
+  like_const = stan::math::NEG_LOG_SQRT_TWO_PI * dim -
+               0.5 * state.var.array().log().sum();
+}
+
+void DiagNNIGHierarchy::clear_data() {
+  data_sum = Eigen::ArrayXd::Zero(dim);
+  data_sum_squares = Eigen::ArrayXd::Zero(dim);
+  card = 0;
+  cluster_data_idx = std::set<int>();
+}
+
+void DiagNNIGHierarchy::update_summary_statistics(const Eigen::VectorXd &datum,
+                                                  bool add) {
+  if (add) {
+    data_sum += datum.array();
+    data_sum_squares += datum.array().square();
+  } else {
+    data_sum -= datum.array();
+    data_sum_squares -= datum.array().square();
+  }
+}
+
+void DiagNNIGHierarchy::update_hypers(
+    const std::vector<bayesmix::MarginalState::ClusterState> &states) {
+  if (prior->has_fixed_values()) {
+    return;
+  }
+
+  else {
+    throw std::invalid_argument("Unrecognized hierarchy prior");
+  }
+}
+
+//! \param datum Row vector containing a single data point
+//! \return      Log-likelihood evaluated in datum
+double DiagNNIGHierarchy::like_lpdf(const Eigen::RowVectorXd &datum) const {
+  return like_const -
+         0.5 * ((datum.transpose() - state.mean).array().square() * prec)
+                   .sum();
+}
+
+//! \param data Matrix whose rows are the data points
+//! \return     Log-likelihood evaluated in each row of data
+Eigen::VectorXd DiagNNIGHierarchy::like_lpdf_grid(
+    const Eigen::MatrixXd &data) const {
+  Eigen::ArrayXXd sq =
+      (data.rowwise() - state.mean.transpose()).array().square();
+  return (like_const -
+          0.5 * (sq.rowwise() * prec.transpose()).rowwise().sum())
+      .matrix();
+}
+
+//! \param datum Row vector containing a single data point
+//! \return      Marginal distribution evaluated in datum (log)
+double DiagNNIGHierarchy::marg_lpdf(const Eigen::RowVectorXd &datum) const {
+  Eigen::ArrayXd sq = (datum.transpose() - hypers->mean).array().square();
+  return marg_utils->log_const -
+         (hypers->shape + 0.5) * (sq * marg_utils->inv_scale).log1p().sum();
+}
+
+//! \param data Matrix whose rows are the data points
+//! \return     Marginal distribution evaluated in each row of data (log)
+Eigen::VectorXd DiagNNIGHierarchy::marg_lpdf_grid(
+    const Eigen::MatrixXd &data) const {
+  Eigen::ArrayXXd sq =
+      (data.rowwise() - hypers->mean.transpose()).array().square();
+  sq.rowwise() *= marg_utils->inv_scale.transpose();
+  return (marg_utils->log_const -
+          (hypers->shape + 0.5) * sq.log1p().rowwise().sum())
+      .matrix();
+}
+
+void DiagNNIGHierarchy::draw_state(const Eigen::ArrayXd &mean,
+                                   double var_scaling, double shape,
+                                   const Eigen::ArrayXd &scale) {
+  auto &rng = bayesmix::Rng::Instance().get();
+  Eigen::VectorXd var(dim);
+  state.mean.resize(dim);
+  for (size_t j = 0; j < dim; j++) {
+    var(j) = stan::math::inv_gamma_rng(shape, scale(j), rng);
+    state.mean(j) =
+        stan::math::normal_rng(mean(j), sqrt(var(j) / var_scaling), rng);
+  }
+  set_var_and_utilities(var);
+}
+
+void DiagNNIGHierarchy::draw() {
+  // Update state values from their prior centering distribution
+  draw_state(hypers->mean.array(), hypers->var_scaling, hypers->shape,
+             hypers->scale.array());
+}
+
+void DiagNNIGHierarchy::sample_given_data() {
+  // Posterior hyperparameters of each coordinate, in O(dim)
+  double var_scaling_n = hypers->var_scaling + card;
+  double shape_n = hypers->shape + 0.5 * card;
+  Eigen::ArrayXd prior_mean = hypers->mean.array();
+  Eigen::ArrayXd mean_n =
+      (hypers->var_scaling * prior_mean + data_sum) / var_scaling_n;
+  Eigen::ArrayXd scale_n =
+      hypers->scale.array() +
+      0.5 * (data_sum_squares +
+             hypers->var_scaling * prior_mean.square() -
+             var_scaling_n * mean_n.square());
+
+  // Update state values from their posterior distribution
+  draw_state(mean_n, var_scaling_n, shape_n, scale_n);
+}
+
+void DiagNNIGHierarchy::sample_given_data(const Eigen::MatrixXd &data) {
+  data_sum = data.colwise().sum().transpose().array();
+  data_sum_squares = data.array().square().colwise().sum().transpose();
+  card = data.rows();
+  log_card = std::log(card);
+  sample_given_data();
+}
+
+void DiagNNIGHierarchy::set_state_from_proto(
+    const google::protobuf::Message &state_) {
+  auto &statecast = google::protobuf::internal::down_cast<
+      const bayesmix::MarginalState::ClusterState &>(state_);
+  state.mean = bayesmix::to_eigen(statecast.diag_ls_state().mean());
+  set_var_and_utilities(bayesmix::to_eigen(statecast.diag_ls_state().var()));
+  set_card(statecast.cardinality());
+}
+
+void DiagNNIGHierarchy::set_prior(const google::protobuf::Message &prior_) {
+  auto &priorcast =
+      google::protobuf::internal::down_cast<const bayesmix::DiagNNIGPrior &>(
+          prior_);
+  prior = std::make_shared<bayesmix::DiagNNIGPrior>(priorcast);
+  hypers = std::make_shared<Hyperparams>();
+  if (prior->has_fixed_values()) {
+    // Set values
+    hypers->mean = bayesmix::to_eigen(prior->fixed_values().mean());
+    dim = hypers->mean.size();
+    hypers->var_scaling = prior->fixed_values().var_scaling();
+    hypers->shape = prior->fixed_values().shape();
+    hypers->scale = bayesmix::to_eigen(prior->fixed_values().scale());
+    // Check validity
+    if (hypers->var_scaling <= 0) {
+      throw std::invalid_argument("Variance-scaling parameter must be > 0");
+    }
+    if (hypers->shape <= 0) {
+      throw std::invalid_argument("Shape parameter must be > 0");
+    }
+    if (hypers->scale.size() != dim) {
+      throw std::invalid_argument(
+          "Scale vector and mean vector have different sizes");
+    }
+    if ((hypers->scale.array() <= 0).any()) {
+      throw std::invalid_argument("Scale parameters must be > 0");
+    }
+  }
+
+  else {
+    throw std::invalid_argument("Unrecognized hierarchy prior");
+  }
+
+  // The coordinates stay independent in the marginal: it is a product of
+  // Student's t sharing the degrees of freedom, so that the normalizing
+  // constant is computed once and only the scales differ
+  double deg_free = 2 * hypers->shape;
+  Eigen::ArrayXd sig2_n = hypers->scale.array() *
+                          (hypers->var_scaling + 1) /
+                          (hypers->shape * hypers->var_scaling);
+  marg_utils = std::make_shared<MargUtilities>();
+  marg_utils->inv_scale = (deg_free * sig2_n).inverse();
+  marg_utils->log_const = dim * bayesmix::student_t_log_const(deg_free) -
+                          0.5 * sig2_n.log().sum();
+}
+
+void DiagNNIGHierarchy::write_state_to_proto(
+    google::protobuf::Message *out) const {
+  bayesmix::DiagLSState state_;
+  bayesmix::to_proto(state.mean, state_.mutable_mean());
+  bayesmix::to_proto(state.var, state_.mutable_var());
+
+  auto *out_cast = google::protobuf::internal::down_cast<
+      bayesmix::MarginalState::ClusterState *>(out);
+  out_cast->mutable_diag_ls_state()->CopyFrom(state_);
+  out_cast->set_cardinality(card);
+}
+
+void DiagNNIGHierarchy::write_hypers_to_proto(
+    google::protobuf::Message *out) const {
+  bayesmix::DiagNNIGPrior hypers_;
+  bayesmix::to_proto(hypers->mean,
+                     hypers_.mutable_fixed_values()->mutable_mean());
+  hypers_.mutable_fixed_values()->set_var_scaling(hypers->var_scaling);
+  hypers_.mutable_fixed_values()->set_shape(hypers->shape);
+  bayesmix::to_proto(hypers->scale,
+                     hypers_.mutable_fixed_values()->mutable_scale());
+
+  google::protobuf::internal::down_cast<bayesmix::DiagNNIGPrior *>(out)
+      ->mutable_fixed_values()
+      ->CopyFrom(hypers_.fixed_values());
+}
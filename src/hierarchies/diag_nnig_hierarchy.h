@@ -0,0 +1,140 @@
+#ifndef BAYESMIX_HIERARCHIES_DIAG_NNIG_HIERARCHY_H_
+#define BAYESMIX_HIERARCHIES_DIAG_NNIG_HIERARCHY_H_
+
+#include <google/protobuf/stubs/casts.h>
+
+#include <Eigen/Dense>
+#include <memory>
+
+#include "base_hierarchy.h"
+#include "hierarchy_prior.pb.h"
+#include "marginal_state.pb.h"
+
+//! Normal Normal-InverseGamma hierarchy with diagonal covariance, for
+//! multivariate data.
+
+//! This class represents a hierarchy, i.e. a cluster, whose multivariate data
+//! are distributed according to a normal likelihood with diagonal covariance
+//! matrix, so that their coordinates are independent given the state. The
+//! parameters of each coordinate have their own Normal-InverseGamma centering
+//! distribution. That is:
+//!           phi = (mu,sig)                 (state);
+//! f(x_i|mu,sig) = prod_j N(mu_j,sig_j^2)   (data likelihood);
+//!    (mu,sig^2) ~ G                        (unique values distribution);
+//!             G ~ MM                       (mixture model);
+//!            G0 = prod_j N-IG              (centering distribution).
+//! state[0] = mu is called location, and state[1] = sig^2 is called variance,
+//! both vectors. The state hyperparameters, contained in the Hypers object,
+//! are (mu_0, lambda0, alpha0, beta0), where mu_0 and beta0 are vectors and
+//! the others are scalars. Note that this hierarchy is conjugate, thus the
+//! marginal (a product of univariate Student's t) and the posterior
+//! distribution are available in closed form and Neal's algorithm 2 may be
+//! used with it. Unlike NNWHierarchy, the likelihood, the marginal and the
+//! posterior update all cost O(dim), and are written as Eigen array
+//! expressions so that they are vectorized.
+
+class DiagNNIGHierarchy : public BaseHierarchy {
+ public:
+  struct State {
+    Eigen::VectorXd mean, var;
+  };
+  struct Hyperparams {
+    Eigen::VectorXd mean;
+    double var_scaling;
+    double shape;
+    Eigen::VectorXd scale;
+  };
+  //! Parameters of the marginal distribution, which only depend on the
+  //! hyperparameters
+  struct MargUtilities {
+    //! 1 / (deg_free * sig_n^2) for each coordinate of the Student's t
+    Eigen::ArrayXd inv_scale;
+    //! Normalizing constant of the log-density
+    double log_const;
+  };
+
+ protected:
+  unsigned int dim;
+  Eigen::ArrayXd data_sum;
+  Eigen::ArrayXd data_sum_squares;
+  // STATE
+  State state;
+  // HYPERPARAMETERS
+  std::shared_ptr<Hyperparams> hypers;
+  // HYPERPRIOR
+  std::shared_ptr<bayesmix::DiagNNIGPrior> prior;
+
+  // UTILITIES FOR LIKELIHOOD COMPUTATION
+  //! Inverse of the variance of each coordinate
+  Eigen::ArrayXd prec;
+  //! Normalizing constant of the log-likelihood
+  double like_const;
+
+  // UTILITIES FOR MARGINAL COMPUTATION
+  //! Computed once by set_prior(), as the hyperparameters are fixed, and
+  //! then shared by the clones
+  std::shared_ptr<MargUtilities> marg_utils;
+
+  // AUXILIARY TOOLS
+  //! Special setter for var and its utilities
+  void set_var_and_utilities(const Eigen::VectorXd &var_);
+  //! Draws the state given the parameters of the N-IG distribution
+  void draw_state(const Eigen::ArrayXd &mean, double var_scaling,
+                  double shape, const Eigen::ArrayXd &scale);
+
+  void clear_data() override;
+
+  void update_summary_statistics(const Eigen::VectorXd &datum,
+                                 bool add) override;
+
+ public:
+  void initialize() override;
+  //! Returns true if the hierarchy models multivariate data (here, true)
+  bool is_multivariate() const override { return true; }
+
+  //! Returns true if the prior has fixed hyperparameter values
+  bool has_fixed_hypers() const override { return prior->has_fixed_values(); }
+
+  void update_hypers(const std::vector<bayesmix::MarginalState::ClusterState>
+                         &states) override;
+
+  // DESTRUCTOR AND CONSTRUCTORS
+  ~DiagNNIGHierarchy() = default;
+  DiagNNIGHierarchy() = default;
+
+  std::shared_ptr<BaseHierarchy> clone() const override {
+    auto out = std::make_shared<DiagNNIGHierarchy>(*this);
+    out->clear_data();
+    return out;
+  }
+
+  // EVALUATION FUNCTIONS
+  //! Evaluates the log-likelihood of data in a single point
+  double like_lpdf(const Eigen::RowVectorXd &datum) const override;
+  //! Evaluates the log-likelihood of data in the given points
+  Eigen::VectorXd like_lpdf_grid(const Eigen::MatrixXd &data) const override;
+  //! Evaluates the log-marginal distribution of data in a single point
+  double marg_lpdf(const Eigen::RowVectorXd &datum) const override;
+  //! Evaluates the log-marginal distribution of data in the given points
+  Eigen::VectorXd marg_lpdf_grid(const Eigen::MatrixXd &data) const override;
+
+  // SAMPLING FUNCTIONS
+  //! Generates new values for state from the centering prior distribution
+  void draw() override;
+  //! Generates new values for state from the centering posterior distribution
+  void sample_given_data() override;
+  void sample_given_data(const Eigen::MatrixXd &data) override;
+
+  // GETTERS AND SETTERS
+  State get_state() const { return state; }
+  Hyperparams get_hypers() const { return *hypers; }
+  unsigned int get_dim() const { return dim; }
+  void set_state_from_proto(const google::protobuf::Message &state_) override;
+  void set_prior(const google::protobuf::Message &prior_) override;
+  void write_state_to_proto(google::protobuf::Message *out) const override;
+  void write_hypers_to_proto(google::protobuf::Message *out) const override;
+
+  std::string get_id() const override { return "DiagNNIG"; }
+};
+
+#endif  // BAYESMIX_HIERARCHIES_DIAG_NNIG_HIERARCHY_H_
@@ -0,0 +1,272 @@
+#include "factor_hierarchy.h"
+
+#include <google/protobuf/stubs/casts.h>
+
+#include <Eigen/Dense>
+#include <stan/math/prim/prob.hpp>
+
+#include "hierarchy_prior.pb.h"
+#include "ls_state.pb.h"
+#include "marginal_state.pb.h"
+#include "src/utils/proto_utils.h"
+#include "src/utils/rng.h"
+
+namespace {
+//! Returns a rows x cols matrix of independent standard normal values
+Eigen::MatrixXd std_normal_matrix(unsigned int rows, unsigned int cols,
+                                  std::mt19937_64 &rng) {
+  Eigen::MatrixXd out(rows, cols);
+  for (size_t j = 0; j < cols; j++) {
+    for (size_t i = 0; i < rows; i++) {
+      out(i, j) = stan::math::normal_rng(0, 1, rng);
+    }
+  }
+  return out;
+}
+}  // namespace
+
+void FactorHierarchy::initialize() {
+  if (prior == nullptr) {
+    throw std::invalid_argument("Hierarchy prior was not provided");
+  }
+  state.mean = hypers->mean;
+  state.loadings = Eigen::MatrixXd::Zero(dim, hypers->num_factors);
+  state.noise_var = hypers->scale / (hypers->shape + 1);
+  set_utilities();
+  clear_data();
+}
+
+void FactorHierarchy::set_utilities() {
+  noise_prec = state.noise_var.cwiseInverse();
+  wood_factor = noise_prec.asDiagonal() * state.loadings;
+  Eigen::MatrixXd M =
+      Eigen::MatrixXd::Identity(state.loadings.cols(), state.loadings.cols()) +
+      state.loadings.transpose() * wood_factor;
+  wood_llt.compute(M);
+  cov_logdet = 2 * wood_llt.matrixLLT().diagonal().array().log().sum() +
+               state.noise_var.array().log().sum();
+}
+
+void FactorHierarchy::clear_data() {
+  cluster_data_values.clear();
+  card = 0;
+  cluster_data_idx = std::set<int>();
+}
+
+void FactorHierarchy::add_datum(const int id, const Eigen::VectorXd &datum) {
+  BaseHierarchy::add_datum(id, datum);
+  cluster_data_values[id] = datum;
+}
+
+void FactorHierarchy::remove_datum(const int id,
+                                   const Eigen::VectorXd &datum) {
+  BaseHierarchy::remove_datum(id, datum);
+  cluster_data_values.erase(id);
+}
+
+void FactorHierarchy::update_hypers(
+    const std::vector<bayesmix::MarginalState::ClusterState> & /*states*/) {
+  if (prior->has_fixed_values()) {
+    return;
+  }
+
+  else {
+    throw std::invalid_argument("Unrecognized hierarchy prior");
+  }
+}
+
+//! \param datum Row vector containing a single data point
+//! \return      Log-likelihood evaluated in datum
+double FactorHierarchy::like_lpdf(const Eigen::RowVectorXd &datum) const {
+  // Woodbury: r^T Sigma^-1 r = r^T diag(psi)^-1 r - |L^-1 W^T r|^2
+  Eigen::VectorXd diff = datum.transpose() - state.mean;
+  Eigen::VectorXd proj =
+      wood_llt.matrixL().solve(wood_factor.transpose() * diff);
+  double quad =
+      (diff.array().square() * noise_prec.array()).sum() - proj.squaredNorm();
+  return stan::math::NEG_LOG_SQRT_TWO_PI * dim - 0.5 * (cov_logdet + quad);
+}
+
+//! \param data Matrix whose rows are the data points
+//! \return     Log-likelihood evaluated in each row of data
+Eigen::VectorXd FactorHierarchy::like_lpdf_grid(
+    const Eigen::MatrixXd &data) const {
+  Eigen::MatrixXd diff = data.rowwise() - state.mean.transpose();
+  Eigen::MatrixXd proj =
+      wood_llt.matrixL().solve((diff * wood_factor).transpose());
+  Eigen::VectorXd quad =
+      diff.array().square().matrix() * noise_prec -
+      proj.colwise().squaredNorm().transpose();
+  return (stan::math::NEG_LOG_SQRT_TWO_PI * dim -
+          0.5 * (cov_logdet + quad.array()))
+      .matrix();
+}
+
+double FactorHierarchy::marg_lpdf(
+    const Eigen::RowVectorXd & /*datum*/) const {
+  throw std::runtime_error(
+      "marg_lpdf() not available for the non-conjugate Factor hierarchy");
+}
+
+void FactorHierarchy::draw() {
+  // Update state values from their prior centering distribution
+  auto &rng = bayesmix::Rng::Instance().get();
+  state.loadings = sqrt(hypers->loadings_var) *
+                   std_normal_matrix(dim, hypers->num_factors, rng);
+  state.mean = hypers->mean +
+               sqrt(hypers->mean_var) * std_normal_matrix(dim, 1, rng);
+  state.noise_var.resize(dim);
+  for (size_t j = 0; j < dim; j++) {
+    state.noise_var(j) =
+        stan::math::inv_gamma_rng(hypers->shape, hypers->scale(j), rng);
+  }
+  set_utilities();
+}
+
+void FactorHierarchy::sample_full_conditionals(const Eigen::MatrixXd &data) {
+  auto &rng = bayesmix::Rng::Instance().get();
+  unsigned int n = data.rows();
+  unsigned int k = hypers->num_factors;
+
+  // Latent factors: eta_i ~ N(M^-1 W^T (x_i - mu), M^-1), with the Woodbury
+  // utilities of the current state
+  Eigen::MatrixXd centered = data.rowwise() - state.mean.transpose();
+  Eigen::MatrixXd eta = wood_llt.solve((centered * wood_factor).transpose());
+  eta += wood_llt.matrixU().solve(std_normal_matrix(k, n, rng));
+  eta.transposeInPlace();
+
+  // Mean: the coordinates are independent given the factors
+  Eigen::ArrayXd resid_sum =
+      (data - eta * state.loadings.transpose()).colwise().sum().transpose();
+  Eigen::ArrayXd mean_prec = 1.0 / hypers->mean_var + n * noise_prec.array();
+  Eigen::ArrayXd mean_n = (hypers->mean.array() / hypers->mean_var +
+                           resid_sum * noise_prec.array()) /
+                          mean_prec;
+  state.mean =
+      (mean_n + std_normal_matrix(dim, 1, rng).array() / mean_prec.sqrt())
+          .matrix();
+
+  // Loadings: the rows are independent given the factors
+  centered = data.rowwise() - state.mean.transpose();
+  Eigen::MatrixXd eta_sq = eta.transpose() * eta;
+  Eigen::MatrixXd cross = eta.transpose() * centered;
+  Eigen::MatrixXd prior_prec =
+      Eigen::MatrixXd::Identity(k, k) / hypers->loadings_var;
+  Eigen::LLT<Eigen::MatrixXd> row_llt;
+  for (size_t j = 0; j < dim; j++) {
+    row_llt.compute(prior_prec + eta_sq * noise_prec(j));
+    state.loadings.row(j) =
+        (row_llt.solve(cross.col(j) * noise_prec(j)) +
+         row_llt.matrixU().solve(std_normal_matrix(k, 1, rng)))
+            .transpose();
+  }
+
+  // Noise variances
+  Eigen::VectorXd ss =
+      (centered - eta * state.loadings.transpose()).colwise().squaredNorm();
+  for (size_t j = 0; j < dim; j++) {
+    state.noise_var(j) = stan::math::inv_gamma_rng(
+        hypers->shape + 0.5 * n, hypers->scale(j) + 0.5 * ss(j), rng);
+  }
+  set_utilities();
+}
+
+void FactorHierarchy::sample_given_data() {
+  Eigen::MatrixXd data(cluster_data_values.size(), dim);
+  int i = 0;
+  for (auto &datum : cluster_data_values) {
+    data.row(i++) = datum.second;
+  }
+  sample_full_conditionals(data);
+}
+
+void FactorHierarchy::sample_given_data(const Eigen::MatrixXd &data) {
+  card = data.rows();
+  log_card = std::log(card);
+  sample_full_conditionals(data);
+}
+
+void FactorHierarchy::set_state_from_proto(
+    const google::protobuf::Message &state_) {
+  auto &statecast = google::protobuf::internal::down_cast<
+      const bayesmix::MarginalState::ClusterState &>(state_);
+  state.mean = bayesmix::to_eigen(statecast.factor_ls_state().mean());
+  state.loadings = bayesmix::to_eigen(statecast.factor_ls_state().loadings());
+  state.noise_var =
+      bayesmix::to_eigen(statecast.factor_ls_state().noise_var());
+  set_utilities();
+  set_card(statecast.cardinality());
+}
+
+void FactorHierarchy::set_prior(const google::protobuf::Message &prior_) {
+  auto &priorcast =
+      google::protobuf::internal::down_cast<const bayesmix::FactorPrior &>(
+          prior_);
+  prior = std::make_shared<bayesmix::FactorPrior>(priorcast);
+  hypers = std::make_shared<Hyperparams>();
+  if (prior->has_fixed_values()) {
+    // Set values
+    hypers->mean = bayesmix::to_eigen(prior->fixed_values().mean());
+    dim = hypers->mean.size();
+    hypers->mean_var = prior->fixed_values().mean_var();
+    hypers->num_factors = prior->fixed_values().num_factors();
+    hypers->loadings_var = prior->fixed_values().loadings_var();
+    hypers->shape = prior->fixed_values().shape();
+    hypers->scale = bayesmix::to_eigen(prior->fixed_values().scale());
+    // Check validity
+    if (hypers->mean_var <= 0) {
+      throw std::invalid_argument("Variance parameter must be > 0");
+    }
+    if (hypers->num_factors == 0 or hypers->num_factors > dim) {
+      throw std::invalid_argument(
+          "Number of factors must be in 1, ..., dimension of the data");
+    }
+    if (hypers->loadings_var <= 0) {
+      throw std::invalid_argument("Variance parameter must be > 0");
+    }
+    if (hypers->shape <= 0) {
+      throw std::invalid_argument("Shape parameter must be > 0");
+    }
+    if (hypers->scale.size() != dim) {
+      throw std::invalid_argument(
+          "Scale vector and mean vector have different sizes");
+    }
+    if ((hypers->scale.array() <= 0).any()) {
+      throw std::invalid_argument("Scale parameters must be > 0");
+    }
+  }
+
+  else {
+    throw std::invalid_argument("Unrecognized hierarchy prior");
+  }
+}
+
+void FactorHierarchy::write_state_to_proto(
+    google::protobuf::Message *out) const {
+  bayesmix::FactorLSState state_;
+  bayesmix::to_proto(state.mean, state_.mutable_mean());
+  bayesmix::to_proto(state.loadings, state_.mutable_loadings());
+  bayesmix::to_proto(state.noise_var, state_.mutable_noise_var());
+
+  auto *out_cast = google::protobuf::internal::down_cast<
+      bayesmix::MarginalState::ClusterState *>(out);
+  out_cast->mutable_factor_ls_state()->CopyFrom(state_);
+  out_cast->set_cardinality(card);
+}
+
+void FactorHierarchy::write_hypers_to_proto(
+    google::protobuf::Message *out) const {
+  bayesmix::FactorPrior hypers_;
+  bayesmix::to_proto(hypers->mean,
+                     hypers_.mutable_fixed_values()->mutable_mean());
+  hypers_.mutable_fixed_values()->set_mean_var(hypers->mean_var);
+  hypers_.mutable_fixed_values()->set_num_factors(hypers->num_factors);
+  hypers_.mutable_fixed_values()->set_loadings_var(hypers->loadings_var);
+  hypers_.mutable_fixed_values()->set_shape(hypers->shape);
+  bayesmix::to_proto(hypers->scale,
+                     hypers_.mutable_fixed_values()->mutable_scale());
+
+  google::protobuf::internal::down_cast<bayesmix::FactorPrior *>(out)
+      ->mutable_fixed_values()
+      ->CopyFrom(hypers_.fixed_values());
+}
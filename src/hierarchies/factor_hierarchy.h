@@ -0,0 +1,141 @@
+#ifndef BAYESMIX_HIERARCHIES_FACTOR_HIERARCHY_H_
+#define BAYESMIX_HIERARCHIES_FACTOR_HIERARCHY_H_
+
+#include <google/protobuf/stubs/casts.h>
+
+#include <Eigen/Dense>
+#include <map>
+#include <memory>
+
+#include "base_hierarchy.h"
+#include "hierarchy_prior.pb.h"
+#include "marginal_state.pb.h"
+
+//! Factor-analytic normal hierarchy for multivariate data.
+
+//! This class represents a hierarchy, i.e. a cluster, whose multivariate data
+//! are distributed according to a normal likelihood with low-rank plus
+//! diagonal covariance matrix. That is:
+//!               phi = (mu,Lambda,psi)            (state);
+//! f(x_i|mu,Lambda,psi) = N(mu,Lambda Lambda^T + diag(psi))
+//!                                                (data likelihood);
+//!                 G0 : mu ~ N(mu0, phi0 I),
+//!                      Lambda_jh ~ N(0, sig2_lambda),
+//!                      psi_j ~ InvGamma(alpha0, beta0_j)
+//!                                                (centering distribution).
+//! Lambda is a dim x k matrix of factor loadings with k << dim, so that the
+//! covariance has full correlations while, thanks to the Woodbury identity,
+//! the likelihood costs O(dim * k) instead of O(dim^2). The same identity
+//! gives the log-determinant as log|M| + sum_j log psi_j, where
+//! M = I_k + Lambda^T diag(psi)^-1 Lambda is a k x k matrix.
+//! Note that this hierarchy is NOT conjugate: the state is updated by a Gibbs
+//! sweep which introduces latent factors eta_i ~ N(0, I_k), so that
+//! x_i = mu + Lambda eta_i + eps_i with eps_i ~ N(0, diag(psi)). Therefore
+//! the hierarchy keeps the data of its cluster, and must be used with Neal's
+//! algorithm 8.
+
+class FactorHierarchy : public BaseHierarchy {
+ public:
+  struct State {
+    Eigen::VectorXd mean;
+    Eigen::MatrixXd loadings;
+    Eigen::VectorXd noise_var;
+  };
+  struct Hyperparams {
+    Eigen::VectorXd mean;
+    double mean_var;
+    unsigned int num_factors;
+    double loadings_var;
+    double shape;
+    Eigen::VectorXd scale;
+  };
+
+ protected:
+  unsigned int dim;
+  //! Data points in the cluster, by index
+  std::map<int, Eigen::VectorXd> cluster_data_values;
+  // STATE
+  State state;
+  // HYPERPARAMETERS
+  std::shared_ptr<Hyperparams> hypers;
+  // HYPERPRIOR
+  std::shared_ptr<bayesmix::FactorPrior> prior;
+
+  // UTILITIES FOR LIKELIHOOD COMPUTATION
+  //! Inverse of the noise variances
+  Eigen::VectorXd noise_prec;
+  //! diag(psi)^-1 * Lambda
+  Eigen::MatrixXd wood_factor;
+  //! Cholesky decomposition of M = I_k + Lambda^T diag(psi)^-1 Lambda
+  Eigen::LLT<Eigen::MatrixXd> wood_llt;
+  //! Determinant of the covariance matrix in logarithmic scale
+  double cov_logdet;
+
+  // AUXILIARY TOOLS
+  //! Recomputes the utilities of the Woodbury identity from the state
+  void set_utilities();
+  //! Gibbs sweep over the latent factors, the mean, the loadings and the
+  //! noise variances, given the rows of data
+  void sample_full_conditionals(const Eigen::MatrixXd &data);
+
+  void clear_data() override;
+
+  //! The Gibbs sweep needs the data themselves, which are stored by
+  //! add_datum(): there are no summary statistics to update
+  void update_summary_statistics(const Eigen::VectorXd & /*datum*/,
+                                 bool /*add*/) override {}
+
+ public:
+  void add_datum(const int id, const Eigen::VectorXd &datum) override;
+  void remove_datum(const int id, const Eigen::VectorXd &datum) override;
+
+  void initialize() override;
+  //! Returns true if the hierarchy models multivariate data (here, true)
+  bool is_multivariate() const override { return true; }
+  //! Returns true if the hierarchy is conjugate (here, false)
+  bool is_conjugate() const override { return false; }
+
+  //! Returns true if the prior has fixed hyperparameter values
+  bool has_fixed_hypers() const override { return prior->has_fixed_values(); }
+
+  void update_hypers(const std::vector<bayesmix::MarginalState::ClusterState>
+                         &states) override;
+
+  // DESTRUCTOR AND CONSTRUCTORS
+  ~FactorHierarchy() = default;
+  FactorHierarchy() = default;
+
+  std::shared_ptr<BaseHierarchy> clone() const override {
+    auto out = std::make_shared<FactorHierarchy>(*this);
+    out->clear_data();
+    return out;
+  }
+
+  // EVALUATION FUNCTIONS
+  //! Evaluates the log-likelihood of data in a single point
+  double like_lpdf(const Eigen::RowVectorXd &datum) const override;
+  //! Evaluates the log-likelihood of data in the given points
+  Eigen::VectorXd like_lpdf_grid(const Eigen::MatrixXd &data) const override;
+  //! The marginal distribution is not available in closed form
+  double marg_lpdf(const Eigen::RowVectorXd &datum) const override;
+
+  // SAMPLING FUNCTIONS
+  //! Generates new values for state from the centering prior distribution
+  void draw() override;
+  //! Generates new values for state by a Gibbs sweep given the cluster data
+  void sample_given_data() override;
+  void sample_given_data(const Eigen::MatrixXd &data) override;
+
+  // GETTERS AND SETTERS
+  State get_state() const { return state; }
+  Hyperparams get_hypers() const { return *hypers; }
+  unsigned int get_dim() const { return dim; }
+  void set_state_from_proto(const google::protobuf::Message &state_) override;
+  void set_prior(const google::protobuf::Message &prior_) override;
+  void write_state_to_proto(google::protobuf::Message *out) const override;
+  void write_hypers_to_proto(google::protobuf::Message *out) const override;
+
+  std::string get_id() const override { return "Factor"; }
+};
+
+#endif  // BAYESMIX_HIERARCHIES_FACTOR_HIERARCHY_H_
@@ -3,6 +3,7 @@
 #include <Eigen/Dense>
 #include <stan/math/prim/err.hpp>
 
+#include "src/utils/distributions.h"
 #include "src/utils/eigen_utils.h"
 #include "src/utils/proto_utils.h"
 #include "src/utils/rng.h"
@@ -72,14 +73,42 @@ double LinRegUniHierarchy::like_lpdf(
       datum(0), state.regression_coeffs.dot(covariate), sqrt(state.var));
 }
 
+Eigen::VectorXd LinRegUniHierarchy::like_lpdf_grid(
+    const Eigen::MatrixXd &data, const Eigen::MatrixXd &covariates) const {
+  Eigen::ArrayXd diff = data.col(0) - covariates * state.regression_coeffs;
+  double base = stan::math::NEG_LOG_SQRT_TWO_PI - 0.5 * std::log(state.var);
+  return (base - 0.5 * diff.square() / state.var).matrix();
+}
+
 double LinRegUniHierarchy::marg_lpdf(
     const Eigen::RowVectorXd &datum,
     const Eigen::RowVectorXd &covariate) const {
-  double sig_n = sqrt(
-      (1 + (covariate * hypers->var_scaling_inv * covariate.transpose())(0)) *
-      hypers->scale / hypers->shape);
-  return stan::math::student_t_lpdf(datum(0), 2 * hypers->shape,
-                                    covariate.dot(hypers->mean), sig_n);
+  // Given the covariate x, y is a Student's t centered in x^T mean, whose
+  // squared scale scale / shape is multiplied by 1 + x^T var_scaling^-1 x:
+  // the second term is the prior variance of x^T beta in units of sig^2
+  Eigen::VectorXd proj =
+      marg_utils->var_scaling_chol.triangularView<Eigen::Lower>().solve(
+          covariate.transpose());
+  double sig2_n = (1 + proj.squaredNorm()) * hypers->scale / hypers->shape;
+  double diff = datum(0) - covariate.dot(hypers->mean);
+  return marg_utils->log_const - 0.5 * std::log(sig2_n) -
+         (hypers->shape + 0.5) *
+             std::log1p(diff * diff / (2 * hypers->shape * sig2_n));
+}
+
+Eigen::VectorXd LinRegUniHierarchy::marg_lpdf_grid(
+    const Eigen::MatrixXd &data, const Eigen::MatrixXd &covariates) const {
+  Eigen::MatrixXd proj =
+      marg_utils->var_scaling_chol.triangularView<Eigen::Lower>().solve(
+          covariates.transpose());
+  Eigen::ArrayXd sig2_n =
+      (1 + proj.colwise().squaredNorm().transpose().array()) * hypers->scale /
+      hypers->shape;
+  Eigen::ArrayXd diff = data.col(0) - covariates * hypers->mean;
+  return (marg_utils->log_const - 0.5 * sig2_n.log() -
+          (hypers->shape + 0.5) *
+              (diff.square() / (2 * hypers->shape * sig2_n)).log1p())
+      .matrix();
 }
 
 void LinRegUniHierarchy::draw() {
@@ -149,6 +178,10 @@ void LinRegUniHierarchy::set_prior(const google::protobuf::Message &prior_) {
   else {
     throw std::invalid_argument("Unrecognized hierarchy prior");
   }
+
+  marg_utils = std::make_shared<MargUtilities>();
+  marg_utils->var_scaling_chol = hypers->var_scaling.llt().matrixL();
+  marg_utils->log_const = bayesmix::student_t_log_const(2 * hypers->shape);
 }
 
 void LinRegUniHierarchy::write_state_to_proto(
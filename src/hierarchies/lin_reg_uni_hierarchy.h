@@ -24,6 +24,16 @@ class LinRegUniHierarchy : public DependentHierarchy {
     double shape;
     double scale;
   };
+  //! Utilities for the marginal (Student's t) distribution, which only
+  //! depend on the hyperparameters
+  struct MargUtilities {
+    //! Lower factor L of the Cholesky decomposition L L^T = var_scaling, so
+    //! that x^T var_scaling^-1 x = |L^-1 x|^2
+    Eigen::MatrixXd var_scaling_chol;
+    //! Part of the normalizing constant of the log-density that does not
+    //! depend on the covariates
+    double log_const;
+  };
 
  protected:
   unsigned int dim;
@@ -40,6 +50,11 @@ class LinRegUniHierarchy : public DependentHierarchy {
   // HYPERPRIOR
   std::shared_ptr<bayesmix::LinRegUniPrior> prior;
 
+  // UTILITIES FOR MARGINAL COMPUTATION
+  //! Built by set_prior() from the fixed hyperparameters; the clones share
+  //! it, so the Cholesky factor of var_scaling is computed only once
+  std::shared_ptr<MargUtilities> marg_utils;
+
   void clear_data();
   void update_summary_statistics(const Eigen::VectorXd &datum,
                                  const Eigen::VectorXd &covariate, bool add);
@@ -56,6 +71,9 @@ class LinRegUniHierarchy : public DependentHierarchy {
   //! Returns true if the hierarchy models multivariate data
   bool is_multivariate() const override { return false; }
 
+  //! Returns true if the prior has fixed hyperparameter values
+  bool has_fixed_hypers() const override { return prior->has_fixed_values(); }
+
   void update_hypers(const std::vector<bayesmix::MarginalState::ClusterState>
                          &states) override;
 
@@ -73,9 +91,19 @@ class LinRegUniHierarchy : public DependentHierarchy {
   //! Evaluates the log-likelihood of data in a single point
   double like_lpdf(const Eigen::RowVectorXd &datum,
                    const Eigen::RowVectorXd &covariate) const override;
+  //! Evaluates the log-likelihood of data in the given points, computing
+  //! all the regression means with a single matrix-vector product
+  Eigen::VectorXd like_lpdf_grid(
+      const Eigen::MatrixXd &data,
+      const Eigen::MatrixXd &covariates) const override;
   //! Evaluates the log-marginal distribution of data in a single point
   double marg_lpdf(const Eigen::RowVectorXd &datum,
                    const Eigen::RowVectorXd &covariate) const override;
+  //! Evaluates the log-marginal distribution of data in the given points,
+  //! computing the predictive variances with a single triangular solve
+  Eigen::VectorXd marg_lpdf_grid(
+      const Eigen::MatrixXd &data,
+      const Eigen::MatrixXd &covariates) const override;
 
   // SAMPLING FUNCTIONS
   //! Generates new values for state from the centering prior distribution
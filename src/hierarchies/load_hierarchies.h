@@ -5,6 +5,8 @@
 #include <memory>
 
 #include "base_hierarchy.h"
+#include "diag_nnig_hierarchy.h"
+#include "factor_hierarchy.h"
 #include "lin_reg_uni_hierarchy.h"
 #include "nnig_hierarchy.h"
 #include "nnw_hierarchy.h"
@@ -21,11 +23,35 @@ __attribute__((constructor)) static void load_hierarchies() {
   Builder<BaseHierarchy> NNWbuilder = []() {
     return std::make_shared<NNWHierarchy>();
   };
+  Builder<BaseHierarchy> NNW2builder = []() {
+    return std::make_shared<NNW2Hierarchy>();
+  };
+  Builder<BaseHierarchy> NNW3builder = []() {
+    return std::make_shared<NNW3Hierarchy>();
+  };
+  Builder<BaseHierarchy> NNW4builder = []() {
+    return std::make_shared<NNW4Hierarchy>();
+  };
+  Builder<BaseHierarchy> NNW8builder = []() {
+    return std::make_shared<NNW8Hierarchy>();
+  };
+  Builder<BaseHierarchy> DiagNNIGbuilder = []() {
+    return std::make_shared<DiagNNIGHierarchy>();
+  };
+  Builder<BaseHierarchy> Factorbuilder = []() {
+    return std::make_shared<FactorHierarchy>();
+  };
   Builder<BaseHierarchy> LinRegUnibuilder = []() {
     return std::make_shared<LinRegUniHierarchy>();
   };
   factory.add_builder(NNIGHierarchy().get_id(), NNIGbuilder);
   factory.add_builder(NNWHierarchy().get_id(), NNWbuilder);
+  factory.add_builder(NNW2Hierarchy().get_id(), NNW2builder);
+  factory.add_builder(NNW3Hierarchy().get_id(), NNW3builder);
+  factory.add_builder(NNW4Hierarchy().get_id(), NNW4builder);
+  factory.add_builder(NNW8Hierarchy().get_id(), NNW8builder);
+  factory.add_builder(DiagNNIGHierarchy().get_id(), DiagNNIGbuilder);
+  factory.add_builder(FactorHierarchy().get_id(), Factorbuilder);
   factory.add_builder(LinRegUniHierarchy().get_id(), LinRegUnibuilder);
 }
 
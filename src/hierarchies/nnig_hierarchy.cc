@@ -8,6 +8,7 @@
 #include "hierarchy_prior.pb.h"
 #include "ls_state.pb.h"
 #include "marginal_state.pb.h"
+#include "src/utils/distributions.h"
 #include "src/utils/rng.h"
 
 void NNIGHierarchy::initialize() {
@@ -15,7 +16,25 @@ void NNIGHierarchy::initialize() {
     throw std::invalid_argument("Hierarchy prior was not provided");
   }
   state.mean = hypers->mean;
-  state.var = hypers->scale / (hypers->shape + 1);
+  set_var_and_utilities(hypers->scale / (hypers->shape + 1));
+}
+
+void NNIGHierarchy::set_var_and_utilities(double var_) {
+  state.var = var_;
+  prec = 1.0 / state.var;
+  like_const = stan::math::NEG_LOG_SQRT_TWO_PI - 0.5 * std::log(state.var);
+}
+
+void NNIGHierarchy::update_marg_utilities() {
+  // Integrating out (mu, sig^2) gives a Student's t centered in mean, whose
+  // squared scale scale / shape is inflated by the factor 1 + 1/var_scaling,
+  // due to the prior uncertainty on mu
+  double deg_free = 2 * hypers->shape;
+  double sig2_n = hypers->scale * (hypers->var_scaling + 1) /
+                  (hypers->shape * hypers->var_scaling);
+  marg_utils->inv_scale = 1.0 / (deg_free * sig2_n);
+  marg_utils->log_const =
+      bayesmix::student_t_log_const(deg_free) - 0.5 * std::log(sig2_n);
 }
 
 //! \param data                        Column vector of data points
@@ -89,6 +108,7 @@ void NNIGHierarchy::update_hypers(
     double sig2_n = 1 / prec;
     // Update hyperparameters with posterior random sampling
     hypers->mean = stan::math::normal_rng(mu_n, sqrt(sig2_n), rng);
+    update_marg_utilities();
   }
 
   else if (prior->has_ngg_prior()) {
@@ -125,6 +145,7 @@ void NNIGHierarchy::update_hypers(
     hypers->mean = stan::math::normal_rng(mu_n, sig_n, rng);
     hypers->var_scaling = stan::math::gamma_rng(alpha_n, beta_n, rng);
     hypers->scale = stan::math::gamma_rng(a_n, b_n, rng);
+    update_marg_utilities();
   }
 
   else {
@@ -132,25 +153,32 @@ void NNIGHierarchy::update_hypers(
   }
 }
 
-//! \param data Column vector containing a single data point
+//! \param data Column vector of data points
 //! \return     Log-Likehood vector evaluated in data
-double NNIGHierarchy::like_lpdf(const Eigen::RowVectorXd &datum) const {
-  return stan::math::normal_lpdf(datum(0), state.mean, sqrt(state.var));
+Eigen::VectorXd NNIGHierarchy::like_lpdf_grid(
+    const Eigen::MatrixXd &data) const {
+  return (like_const -
+          0.5 * prec * (data.col(0).array() - state.mean).square())
+      .matrix();
 }
 
 //! \param data Column vector of data points
 //! \return     Marginal distribution vector evaluated in data (log)
-double NNIGHierarchy::marg_lpdf(const Eigen::RowVectorXd &datum) const {
-  double sig_n = sqrt(hypers->scale * (hypers->var_scaling + 1) /
-                      (hypers->shape * hypers->var_scaling));
-  return stan::math::student_t_lpdf(datum(0), 2 * hypers->shape, hypers->mean,
-                                    sig_n);
+Eigen::VectorXd NNIGHierarchy::marg_lpdf_grid(
+    const Eigen::MatrixXd &data) const {
+  return (marg_utils->log_const -
+          (hypers->shape + 0.5) *
+              ((data.col(0).array() - hypers->mean).square() *
+               marg_utils->inv_scale)
+                  .log1p())
+      .matrix();
 }
 
 void NNIGHierarchy::draw() {
   // Update state values from their prior centering distribution
   auto &rng = bayesmix::Rng::Instance().get();
-  state.var = stan::math::inv_gamma_rng(hypers->shape, hypers->scale, rng);
+  set_var_and_utilities(
+      stan::math::inv_gamma_rng(hypers->shape, hypers->scale, rng));
   state.mean = stan::math::normal_rng(
       hypers->mean, sqrt(state.var / hypers->var_scaling), rng);
 }
@@ -161,7 +189,8 @@ void NNIGHierarchy::sample_given_data() {
 
   // Update state values from their prior centering distribution
   auto &rng = bayesmix::Rng::Instance().get();
-  state.var = stan::math::inv_gamma_rng(params.shape, params.scale, rng);
+  set_var_and_utilities(
+      stan::math::inv_gamma_rng(params.shape, params.scale, rng));
   state.mean = stan::math::normal_rng(
       params.mean, sqrt(state.var / params.var_scaling), rng);
 }
@@ -179,7 +208,10 @@ void NNIGHierarchy::set_state_from_proto(
   auto &statecast = google::protobuf::internal::down_cast<
       const bayesmix::MarginalState::ClusterState &>(state_);
   state.mean = statecast.uni_ls_state().mean();
-  state.var = statecast.uni_ls_state().var();
+  if (statecast.uni_ls_state().var() <= 0) {
+    throw std::invalid_argument("Variance parameter must be > 0");
+  }
+  set_var_and_utilities(statecast.uni_ls_state().var());
   set_card(statecast.cardinality());
 }
 
@@ -267,6 +299,9 @@ void NNIGHierarchy::set_prior(const google::protobuf::Message &prior_) {
   else {
     throw std::invalid_argument("Unrecognized hierarchy prior");
   }
+
+  marg_utils = std::make_shared<MargUtilities>();
+  update_marg_utilities();
 }
 
 void NNIGHierarchy::write_state_to_proto(
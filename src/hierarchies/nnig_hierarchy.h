@@ -4,6 +4,7 @@
 #include <google/protobuf/stubs/casts.h>
 
 #include <Eigen/Dense>
+#include <cmath>
 #include <memory>
 
 #include "base_hierarchy.h"
@@ -34,6 +35,14 @@ class NNIGHierarchy : public BaseHierarchy {
   struct Hyperparams {
     double mean, var_scaling, shape, scale;
   };
+  //! Parameters of the marginal (Student's t) distribution, which only
+  //! depend on the hyperparameters
+  struct MargUtilities {
+    //! 1 / (deg_free * sig_n^2), where sig_n is the scale of the Student's t
+    double inv_scale;
+    //! Normalizing constant of the log-density
+    double log_const;
+  };
 
  protected:
   double data_sum = 0;
@@ -45,6 +54,17 @@ class NNIGHierarchy : public BaseHierarchy {
   // HYPERPRIOR
   std::shared_ptr<bayesmix::NNIGPrior> prior;
 
+  // UTILITIES FOR LIKELIHOOD COMPUTATION
+  //! Inverse of the variance
+  double prec;
+  //! Normalizing constant of the log-likelihood, i.e. -log(sqrt(2 pi var))
+  double like_const;
+
+  // UTILITIES FOR MARGINAL COMPUTATION
+  //! Points to the same object for all the clones, which update_hypers()
+  //! refreshes in place after drawing new hyperparameters
+  std::shared_ptr<MargUtilities> marg_utils;
+
   void clear_data() override;
 
   void update_summary_statistics(const Eigen::VectorXd &datum,
@@ -53,12 +73,19 @@ class NNIGHierarchy : public BaseHierarchy {
   // AUXILIARY TOOLS
   //! Returns updated values of the prior hyperparameters via their posterior
   Hyperparams normal_invgamma_update();
+  //! Special setter for var and its utilities
+  void set_var_and_utilities(double var_);
+  //! Recomputes the marginal utilities from the current hyperparameters
+  void update_marg_utilities();
 
  public:
   void initialize() override;
   //! Returns true if the hierarchy models multivariate data (here, false)
   bool is_multivariate() const override { return false; }
 
+  //! Returns true if the prior has fixed hyperparameter values
+  bool has_fixed_hypers() const override { return prior->has_fixed_values(); }
+
   void update_hypers(const std::vector<bayesmix::MarginalState::ClusterState>
                          &states) override;
 
@@ -73,10 +100,23 @@ class NNIGHierarchy : public BaseHierarchy {
   }
 
   // EVALUATION FUNCTIONS
-  //! Evaluates the log-likelihood of data in a single point
-  double like_lpdf(const Eigen::RowVectorXd &datum) const override;
+  //! Evaluates the log-likelihood of data in a single point. This and
+  //! marg_lpdf() are plain arithmetic on cached constants, without argument
+  //! checks: they are called once per datum and cluster at every iteration
+  double like_lpdf(const Eigen::RowVectorXd &datum) const override {
+    double diff = datum(0) - state.mean;
+    return like_const - 0.5 * prec * diff * diff;
+  }
+  //! Evaluates the log-likelihood of data in the given points
+  Eigen::VectorXd like_lpdf_grid(const Eigen::MatrixXd &data) const override;
   //! Evaluates the log-marginal distribution of data in a single point
-  double marg_lpdf(const Eigen::RowVectorXd &datum) const override;
+  double marg_lpdf(const Eigen::RowVectorXd &datum) const override {
+    double diff = datum(0) - hypers->mean;
+    double sq = diff * diff * marg_utils->inv_scale;
+    return marg_utils->log_const - (hypers->shape + 0.5) * std::log1p(sq);
+  }
+  //! Evaluates the log-marginal distribution of data in the given points
+  Eigen::VectorXd marg_lpdf_grid(const Eigen::MatrixXd &data) const override;
 
   // SAMPLING FUNCTIONS
   //! Generates new values for state from the centering prior distribution
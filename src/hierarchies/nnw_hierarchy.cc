@@ -14,48 +14,157 @@
 #include "src/utils/proto_utils.h"
 #include "src/utils/rng.h"
 
+namespace {
+//! Returns the dimension of the data that the given prior is meant for
+int prior_dimension(const bayesmix::NNWPrior &prior) {
+  if (prior.has_fixed_values()) {
+    return prior.fixed_values().mean().data_size();
+  }
+  if (prior.has_normal_mean_prior()) {
+    return prior.normal_mean_prior().mean_prior().mean().data_size();
+  }
+  if (prior.has_ngiw_prior()) {
+    return prior.ngiw_prior().mean_prior().mean().data_size();
+  }
+  return 0;
+}
+}  // namespace
+
 //! \param prec_ Value to set to prec
-void NNWHierarchy::set_prec_and_utilities(const Eigen::MatrixXd &prec_) {
+template <int Dim>
+void NNWHierarchyDim<Dim>::set_prec_and_utilities(const Matrix &prec_) {
   state.prec = prec_;
 
   // Update prec utilities
-  prec_chol = Eigen::LLT<Eigen::MatrixXd>(prec_).matrixL().transpose();
-  Eigen::VectorXd diag = prec_chol.diagonal();
-  prec_logdet = 2 * log(diag.array()).sum();
+  prec_chol = Eigen::LLT<Matrix>(prec_).matrixL().transpose();
+  prec_logdet = 2 * log(prec_chol.diagonal().array()).sum();
+}
+
+//! \param prec_factor Upper triangular factor of the new prec
+//! \param mean, var_scaling Parameters of the normal distribution of the mean
+template <int Dim>
+void NNWHierarchyDim<Dim>::set_state_from_factor(const Matrix &prec_factor,
+                                                 const Vector &mean,
+                                                 double var_scaling) {
+  state.prec = prec_factor.template triangularView<Eigen::Upper>() *
+               prec_factor.transpose();
+
+  // Update prec utilities, without factorizing prec
+  prec_chol = prec_factor.transpose();
+  prec_logdet = 2 * log(prec_chol.diagonal().array().abs()).sum();
+
+  // mean ~ N(mean, (var_scaling * prec)^-1), i.e.
+  // mean + prec_chol^-1 z / sqrt(var_scaling) with z standard normal
+  auto &rng = bayesmix::Rng::Instance().get();
+  Vector z(dim);
+  for (size_t i = 0; i < dim; i++) {
+    z(i) = stan::math::normal_rng(0.0, 1.0, rng);
+  }
+  prec_chol.template triangularView<Eigen::Lower>().solveInPlace(z);
+  state.mean = mean + z / std::sqrt(var_scaling);
+}
+
+template <int Dim>
+void NNWHierarchyDim<Dim>::update_marg_utilities() {
+  // Compute dof and scale of marginal distribution
+  marg_utils->deg_free = 2 * hypers->deg_free - dim + 1;
+  marg_utils->mean = hypers->mean;
+  double coeff = (hypers->deg_free - 0.5 * (dim - 1)) * hypers->var_scaling /
+                 (hypers->var_scaling + 1);
+  marg_utils->scale_chol =
+      Eigen::LLT<Matrix>(hypers->scale_inv * coeff).matrixL();
+  double scale_logdet =
+      2 * log(marg_utils->scale_chol.diagonal().array()).sum();
+
+  // The upper factor of the scale is the reversed lower factor of the
+  // reversed scale
+  Matrix reversed_chol = Eigen::LLT<Matrix>(hypers->scale.reverse()).matrixL();
+  marg_utils->wishart_scale_factor = reversed_chol.reverse();
+
+  double nu = marg_utils->deg_free;
+  marg_utils->log_const = stan::math::lgamma(0.5 * (nu + dim)) -
+                          stan::math::lgamma(0.5 * nu) -
+                          0.5 * dim * log(nu * stan::math::pi()) -
+                          0.5 * scale_logdet;
+  marg_utils->version++;
 }
 
-void NNWHierarchy::initialize() {
+template <int Dim>
+void NNWHierarchyDim<Dim>::update_post_utilities() {
+  // With lambda_n = lambda0 + card, the inverse posterior scale is
+  // scale_inv + 0.5 * (S + lambda0 mu0 mu0^T - lambda_n mu_n mu_n^T), where S
+  // is the sum of the outer products of the data
+  double lambda_n = hypers->var_scaling + card;
+  post_mean = (hypers->var_scaling * hypers->mean + data_sum) / lambda_n;
+  Matrix tau_temp =
+      data_sum_squares +
+      hypers->var_scaling * hypers->mean * hypers->mean.transpose() -
+      lambda_n * post_mean * post_mean.transpose();
+  post_scale_inv_llt.compute(0.5 * tau_temp + hypers->scale_inv);
+  post_version = marg_utils->version;
+  post_num_updates = 0;
+}
+
+template <int Dim>
+void NNWHierarchyDim<Dim>::initialize() {
   if (prior == nullptr) {
     throw std::invalid_argument("Hierarchy prior was not provided");
   }
   state.mean = hypers->mean;
-  set_prec_and_utilities(hypers->var_scaling *
-                         Eigen::MatrixXd::Identity(dim, dim));
+  set_prec_and_utilities(hypers->var_scaling * Matrix::Identity(dim, dim));
   clear_data();
 }
 
-void NNWHierarchy::clear_data() {
-  data_sum = Eigen::VectorXd::Zero(dim);
-  data_sum_squares = Eigen::MatrixXd::Zero(dim, dim);
+template <int Dim>
+void NNWHierarchyDim<Dim>::clear_data() {
+  data_sum = Vector::Zero(dim);
+  data_sum_squares = Matrix::Zero(dim, dim);
   card = 0;
   cluster_data_idx = std::set<int>();
+  post_version = -1;
 }
 
-void NNWHierarchy::update_summary_statistics(const Eigen::VectorXd &datum,
-                                             bool add) {
+template <int Dim>
+void NNWHierarchyDim<Dim>::update_summary_statistics(
+    const Eigen::VectorXd &datum_, bool add) {
+  const Vector datum = datum_;
+  // The posterior utilities are updated in O(dim^2) if they are current
+  bool post_current = (post_version == marg_utils->version);
   if (add) {
     data_sum += datum;
     data_sum_squares += datum * datum.transpose();
+    if (post_current) {
+      // card already accounts for datum
+      double lambda = hypers->var_scaling + card - 1;
+      Vector diff = datum - post_mean;
+      post_scale_inv_llt.rankUpdate(diff, 0.5 * lambda / (lambda + 1));
+      post_mean = (lambda * post_mean + datum) / (lambda + 1);
+    }
   } else {
     data_sum -= datum;
     data_sum_squares -= datum * datum.transpose();
+    if (post_current) {
+      // card still accounts for datum
+      double lambda = hypers->var_scaling + card - 1;
+      post_mean = ((lambda + 1) * post_mean - datum) / lambda;
+      Vector diff = datum - post_mean;
+      post_scale_inv_llt.rankUpdate(diff, -0.5 * lambda / (lambda + 1));
+      if (post_scale_inv_llt.info() != Eigen::Success) {
+        post_version = -1;
+      }
+    }
+  }
+  if (post_current and ++post_num_updates >= max_post_updates) {
+    post_version = -1;
   }
 }
 
 //! \param data                    Matrix of row-vectorial data points
 //! \param mu0, lambda0, tau0, nu0 Original values for hyperparameters
 //! \return                        Vector of updated values for hyperparameters
-NNWHierarchy::Hyperparams NNWHierarchy::normal_wishart_update() {
+template <int Dim>
+typename NNWHierarchyDim<Dim>::Hyperparams
+NNWHierarchyDim<Dim>::normal_wishart_update() {
   // Initialize relevant objects
   Hyperparams post_params;
 
@@ -63,20 +172,18 @@ NNWHierarchy::Hyperparams NNWHierarchy::normal_wishart_update() {
   post_params.var_scaling = hypers->var_scaling + card;
   post_params.deg_free = hypers->deg_free + 0.5 * card;
 
-  Eigen::VectorXd mubar = data_sum.array() / card;  // sample mean
-  post_params.mean = (hypers->var_scaling * hypers->mean + card * mubar) /
-                     (hypers->var_scaling + card);
-  // Compute tau_n
-  Eigen::MatrixXd tau_temp =
-      data_sum_squares - card * mubar * mubar.transpose();
-  tau_temp += (card * hypers->var_scaling / (card + hypers->var_scaling)) *
-              (mubar - hypers->mean) * (mubar - hypers->mean).transpose();
-  tau_temp = 0.5 * tau_temp + hypers->scale_inv;
-  post_params.scale = stan::math::inverse_spd(tau_temp);
+  // Mean and tau_n are kept up to date while data are added and removed,
+  // unless the hyperparameters have changed in the meantime
+  if (post_version != marg_utils->version) {
+    update_post_utilities();
+  }
+  post_params.mean = post_mean;
+  post_params.scale = post_scale_inv_llt.solve(Matrix::Identity(dim, dim));
   return post_params;
 }
 
-void NNWHierarchy::update_hypers(
+template <int Dim>
+void NNWHierarchyDim<Dim>::update_hypers(
     const std::vector<bayesmix::MarginalState::ClusterState> &states) {
   auto &rng = bayesmix::Rng::Instance().get();
   if (prior->has_fixed_values()) {
@@ -151,60 +258,97 @@ void NNWHierarchy::update_hypers(
   else {
     throw std::invalid_argument("Unrecognized hierarchy prior");
   }
+  update_marg_utilities();
 }
 
 //! \param data Matrix of row-vectorial single data point
 //! \return     Log-Likehood vector evaluated in data
-double NNWHierarchy::like_lpdf(const Eigen::RowVectorXd &datum) const {
-  // Initialize relevant objects
-  return bayesmix::multi_normal_prec_lpdf(datum, state.mean, prec_chol,
-                                          prec_logdet);
+template <int Dim>
+double NNWHierarchyDim<Dim>::like_lpdf(const Eigen::RowVectorXd &datum) const {
+  // Same as bayesmix::multi_normal_prec_lpdf, with temporaries of size Dim
+  Vector diff = datum.transpose() - state.mean;
+  double base = prec_logdet + stan::math::NEG_LOG_SQRT_TWO_PI * dim;
+  return 0.5 * (base - (prec_chol * diff).squaredNorm());
+}
+
+//! \param data Matrix of row-vectorial data points
+//! \return     Log-Likehood vector evaluated in data
+template <int Dim>
+Eigen::VectorXd NNWHierarchyDim<Dim>::like_lpdf_grid(
+    const Eigen::MatrixXd &data) const {
+  return bayesmix::multi_normal_prec_lpdf_grid(data, state.mean, prec_chol,
+                                               prec_logdet);
 }
 
 //! \param data Matrix of row-vectorial a single data point
 //! \return     Marginal distribution vector evaluated in data
-double NNWHierarchy::marg_lpdf(const Eigen::RowVectorXd &datum) const {
-  // Compute dof and scale of marginal distribution
-  double nu_n = 2 * hypers->deg_free - dim + 1;
-  Eigen::MatrixXd sigma_n = hypers->scale_inv *
-                            (hypers->deg_free - 0.5 * (dim - 1)) *
-                            hypers->var_scaling / (hypers->var_scaling + 1);
+template <int Dim>
+double NNWHierarchyDim<Dim>::marg_lpdf(const Eigen::RowVectorXd &datum) const {
+  // Squared Mahalanobis distance through a triangular solve with the cached
+  // Cholesky factor of the scale matrix
+  Vector diff = datum.transpose() - marg_utils->mean;
+  marg_utils->scale_chol.template triangularView<Eigen::Lower>().solveInPlace(
+      diff);
+  double nu = marg_utils->deg_free;
+  return marg_utils->log_const -
+         0.5 * (nu + dim) * stan::math::log1p(diff.squaredNorm() / nu);
+}
 
-  // TODO: chec if this is optimized as our bayesmix::multi_normal_prec_lpdf
-  return stan::math::multi_student_t_lpdf(datum, nu_n, hypers->mean, sigma_n);
+//! \param data Matrix of row-vectorial data points
+//! \return     Marginal distribution vector evaluated in data (log)
+template <int Dim>
+Eigen::VectorXd NNWHierarchyDim<Dim>::marg_lpdf_grid(
+    const Eigen::MatrixXd &data) const {
+  // One triangular solve for all the points, with one point per column
+  Eigen::MatrixXd diff =
+      (data.rowwise() - marg_utils->mean.transpose()).transpose();
+  marg_utils->scale_chol.template triangularView<Eigen::Lower>().solveInPlace(
+      diff);
+  double nu = marg_utils->deg_free;
+  Eigen::ArrayXd dist = diff.colwise().squaredNorm().transpose().array();
+  return marg_utils->log_const - 0.5 * (nu + dim) * (dist / nu).log1p();
 }
 
-void NNWHierarchy::draw() {
+template <int Dim>
+void NNWHierarchyDim<Dim>::draw() {
   // Generate new state values from their prior centering distribution
   auto &rng = bayesmix::Rng::Instance().get();
-  Eigen::MatrixXd tau_new =
-      stan::math::wishart_rng(hypers->deg_free, hypers->scale, rng);
+  Matrix bartlett(dim, dim);
+  bayesmix::wishart_bartlett_rng(hypers->deg_free, rng, bartlett);
 
   // Update state
-  state.mean = stan::math::multi_normal_prec_rng(
-      hypers->mean, tau_new * hypers->var_scaling, rng);
-  set_prec_and_utilities(tau_new);
+  Matrix prec_factor = marg_utils->wishart_scale_factor
+                           .template triangularView<Eigen::Upper>() *
+                       bartlett;
+  set_state_from_factor(prec_factor, hypers->mean, hypers->var_scaling);
 }
 
 //! \param data Matrix of row-vectorial data points
-void NNWHierarchy::sample_given_data() {
+template <int Dim>
+void NNWHierarchyDim<Dim>::sample_given_data() {
   // Update values
-  Hyperparams params = normal_wishart_update();
+  if (post_version != marg_utils->version) {
+    update_post_utilities();
+  }
+  double var_scaling = hypers->var_scaling + card;
+  double deg_free = hypers->deg_free + 0.5 * card;
 
-  // Generate new state values from their prior centering distribution
+  // Generate new state values from their posterior centering distribution:
+  // with tau_n = L L^T, the posterior scale is L^-T (L^-T)^T, and L^-T is
+  // upper triangular
   auto &rng = bayesmix::Rng::Instance().get();
-  Eigen::MatrixXd tau_new =
-      stan::math::wishart_rng(params.deg_free, params.scale, rng);
-  state.mean = stan::math::multi_normal_prec_rng(
-      params.mean, tau_new * params.var_scaling, rng);
+  Matrix bartlett(dim, dim);
+  bayesmix::wishart_bartlett_rng(deg_free, rng, bartlett);
+  Matrix prec_factor = post_scale_inv_llt.matrixU().solve(bartlett);
 
   // Update state
-  set_prec_and_utilities(tau_new);
+  set_state_from_factor(prec_factor, post_mean, var_scaling);
 }
 
-void NNWHierarchy::sample_given_data(const Eigen::MatrixXd &data) {
-  data_sum = Eigen::VectorXd::Zero(data.cols());
-  data_sum_squares = Eigen::MatrixXd::Zero(data.cols(), data.cols());
+template <int Dim>
+void NNWHierarchyDim<Dim>::sample_given_data(const Eigen::MatrixXd &data) {
+  data_sum = Vector::Zero(data.cols());
+  data_sum_squares = Matrix::Zero(data.cols(), data.cols());
 
   for (int i = 0; i < data.rows(); i++) {
     data_sum += data.row(i);
@@ -212,10 +356,12 @@ void NNWHierarchy::sample_given_data(const Eigen::MatrixXd &data) {
   }
   card = data.rows();
   log_card = std::log(card);
+  post_version = -1;
   sample_given_data();
 }
 
-void NNWHierarchy::set_state_from_proto(
+template <int Dim>
+void NNWHierarchyDim<Dim>::set_state_from_proto(
     const google::protobuf::Message &state_) {
   auto &statecast = google::protobuf::internal::down_cast<
       const bayesmix::MarginalState::ClusterState &>(state_);
@@ -224,10 +370,15 @@ void NNWHierarchy::set_state_from_proto(
   set_card(statecast.cardinality());
 }
 
-void NNWHierarchy::set_prior(const google::protobuf::Message &prior_) {
+template <int Dim>
+void NNWHierarchyDim<Dim>::set_prior(const google::protobuf::Message &prior_) {
   auto &priorcast =
       google::protobuf::internal::down_cast<const bayesmix::NNWPrior &>(
           prior_);
+  if (Dim != Eigen::Dynamic and prior_dimension(priorcast) != Dim) {
+    throw std::invalid_argument(
+        "Prior dimension does not match the hierarchy " + get_id());
+  }
   prior = std::make_shared<bayesmix::NNWPrior>(priorcast);
   hypers = std::make_shared<Hyperparams>();
   if (prior->has_fixed_values()) {
@@ -336,9 +487,14 @@ void NNWHierarchy::set_prior(const google::protobuf::Message &prior_) {
   else {
     throw std::invalid_argument("Unrecognized hierarchy prior");
   }
+  marg_utils = std::make_shared<MargUtilities>();
+  update_marg_utilities();
+  post_version = -1;
 }
 
-void NNWHierarchy::write_state_to_proto(google::protobuf::Message *out) const {
+template <int Dim>
+void NNWHierarchyDim<Dim>::write_state_to_proto(
+    google::protobuf::Message *out) const {
   bayesmix::MultiLSState state_;
   bayesmix::to_proto(state.mean, state_.mutable_mean());
   bayesmix::to_proto(state.prec, state_.mutable_prec());
@@ -348,7 +504,8 @@ void NNWHierarchy::write_state_to_proto(google::protobuf::Message *out) const {
   out_cast->set_cardinality(card);
 }
 
-void NNWHierarchy::write_hypers_to_proto(
+template <int Dim>
+void NNWHierarchyDim<Dim>::write_hypers_to_proto(
     google::protobuf::Message *out) const {
   bayesmix::NNWPrior hypers_;
   bayesmix::to_proto(hypers->mean,
@@ -362,3 +519,9 @@ void NNWHierarchy::write_hypers_to_proto(
       ->mutable_fixed_values()
       ->CopyFrom(hypers_.fixed_values());
 }
+
+template class NNWHierarchyDim<Eigen::Dynamic>;
+template class NNWHierarchyDim<2>;
+template class NNWHierarchyDim<3>;
+template class NNWHierarchyDim<4>;
+template class NNWHierarchyDim<8>;
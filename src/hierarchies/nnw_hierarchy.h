@@ -5,6 +5,7 @@
 
 #include <Eigen/Dense>
 #include <memory>
+#include <string>
 #include <stan/math/prim/fun.hpp>
 
 #include "base_hierarchy.h"
@@ -27,25 +28,53 @@
 //! scalar. Note that this hierarchy is conjugate, thus the marginal and the
 //! posterior distribution are available in closed form and Neal's algorithm 2
 //! may be used with it.
-
-class NNWHierarchy : public BaseHierarchy {
+//! The template parameter Dim is the dimension of the data: NNWHierarchy
+//! (Dim = Eigen::Dynamic) works with any dimension, while the fixed-dimension
+//! variants (NNW2Hierarchy, ...) keep every vector and matrix on the stack,
+//! so that the per-datum kernels are unrolled and allocation-free. Their
+//! prior is still a NNWPrior, whose dimension must be Dim.
+
+template <int Dim>
+class NNWHierarchyDim : public BaseHierarchy {
  public:
+  // Fixed-size members are not aligned, so that objects can be created with
+  // std::make_shared
+  static constexpr int Options =
+      (Dim == Eigen::Dynamic) ? Eigen::AutoAlign : Eigen::DontAlign;
+  typedef Eigen::Matrix<double, Dim, 1, Options> Vector;
+  typedef Eigen::Matrix<double, Dim, Dim, Options> Matrix;
+
   struct State {
-    Eigen::VectorXd mean;
-    Eigen::MatrixXd prec;
+    Vector mean;
+    Matrix prec;
   };
   struct Hyperparams {
-    Eigen::VectorXd mean;
+    Vector mean;
     double var_scaling;
     double deg_free;
-    Eigen::MatrixXd scale;
-    Eigen::MatrixXd scale_inv;
+    Matrix scale;
+    Matrix scale_inv;
+  };
+  //! Utilities which only depend on the hyperparameters: parameters of the
+  //! marginal (multivariate Student's t) distribution, and factor of the
+  //! prior Wishart scale
+  struct MargUtilities {
+    double deg_free;
+    Vector mean;
+    //! Lower factor of the Cholesky decomposition of the scale matrix
+    Matrix scale_chol;
+    //! Normalizing constant of the log-density, including the log-determinant
+    double log_const;
+    //! Upper triangular U such that U U^T = scale, for Bartlett sampling
+    Matrix wishart_scale_factor;
+    //! Incremented each time the hyperparameters change
+    int version = 0;
   };
 
  protected:
   unsigned int dim;
-  Eigen::VectorXd data_sum;
-  Eigen::MatrixXd data_sum_squares;
+  Vector data_sum;
+  Matrix data_sum_squares;
   // STATE
   State state;
   // HYPERPARAMETERS
@@ -54,14 +83,43 @@ class NNWHierarchy : public BaseHierarchy {
   std::shared_ptr<bayesmix::NNWPrior> prior;
 
   // UTILITIES FOR LIKELIHOOD COMPUTATION
-  //! Lower factor of the Cholesky decomposition of prec
-  Eigen::MatrixXd prec_chol;
+  //! Triangular factor of prec, such that prec = prec_chol^T * prec_chol
+  Matrix prec_chol;
   //! Determinant of prec in logarithmic scale
   double prec_logdet;
 
+  // UTILITIES FOR MARGINAL COMPUTATION
+  //! Shared by all the clones, like hypers, so that it is computed only once
+  //! each time the hyperparameters change
+  std::shared_ptr<MargUtilities> marg_utils;
+
+  // UTILITIES FOR POSTERIOR COMPUTATION
+  //! Posterior mean of the location given the data in the cluster
+  Vector post_mean;
+  //! Cholesky decomposition of the inverse of the posterior scale, kept up to
+  //! date by rank-one updates and downdates as data are added and removed
+  Eigen::LLT<Matrix> post_scale_inv_llt;
+  //! Version of the hyperparameters that the two above were computed with,
+  //! -1 if they must be recomputed from the summary statistics
+  int post_version = -1;
+  //! Number of rank-one updates since the posterior utilities were computed
+  //! from the summary statistics
+  unsigned int post_num_updates = 0;
+  //! The posterior utilities are recomputed after this many rank-one updates,
+  //! so that their round-off errors do not accumulate over the whole chain
+  static constexpr unsigned int max_post_updates = 100;
+
   // AUXILIARY TOOLS
   //! Special setter for prec and its utilities
-  void set_prec_and_utilities(const Eigen::MatrixXd &prec_);
+  void set_prec_and_utilities(const Matrix &prec_);
+  //! Sets prec = prec_factor * prec_factor^T and its utilities, for an upper
+  //! triangular prec_factor, and draws the mean given prec
+  void set_state_from_factor(const Matrix &prec_factor, const Vector &mean,
+                             double var_scaling);
+  //! Recomputes the marginal utilities from the current hyperparameters
+  void update_marg_utilities();
+  //! Recomputes the posterior utilities from the summary statistics
+  void update_post_utilities();
 
   void clear_data() override;
 
@@ -76,14 +134,17 @@ class NNWHierarchy : public BaseHierarchy {
   //! Returns true if the hierarchy models multivariate data (here, true)
   bool is_multivariate() const override { return true; }
 
+  //! Returns true if the prior has fixed hyperparameter values
+  bool has_fixed_hypers() const override { return prior->has_fixed_values(); }
+
   void update_hypers(const std::vector<bayesmix::MarginalState::ClusterState>
                          &states) override;
 
   // DESTRUCTOR AND CONSTRUCTORS
-  ~NNWHierarchy() = default;
-  NNWHierarchy() = default;
+  ~NNWHierarchyDim() = default;
+  NNWHierarchyDim() = default;
   std::shared_ptr<BaseHierarchy> clone() const override {
-    auto out = std::make_shared<NNWHierarchy>(*this);
+    auto out = std::make_shared<NNWHierarchyDim<Dim>>(*this);
     out->clear_data();
     return out;
   }
@@ -91,8 +152,12 @@ class NNWHierarchy : public BaseHierarchy {
   // EVALUATION FUNCTIONS
   //! Evaluates the log-likelihood of data in a single point
   double like_lpdf(const Eigen::RowVectorXd &datum) const override;
+  //! Evaluates the log-likelihood of data in the given points
+  Eigen::VectorXd like_lpdf_grid(const Eigen::MatrixXd &data) const override;
   //! Evaluates the log-marginal distribution of data in a single point
   double marg_lpdf(const Eigen::RowVectorXd &datum) const override;
+  //! Evaluates the log-marginal distribution of data in the given points
+  Eigen::VectorXd marg_lpdf_grid(const Eigen::MatrixXd &data) const override;
 
   // SAMPLING FUNCTIONS
   //! Generates new values for state from the centering prior distribution
@@ -109,7 +174,27 @@ class NNWHierarchy : public BaseHierarchy {
   void write_state_to_proto(google::protobuf::Message *out) const override;
   void write_hypers_to_proto(google::protobuf::Message *out) const override;
 
-  std::string get_id() const override { return "NNW"; }
+  unsigned int get_dim() const { return dim; }
+
+  std::string get_id() const override {
+    return (Dim == Eigen::Dynamic) ? "NNW" : "NNW" + std::to_string(Dim);
+  }
 };
 
+//! NNW hierarchy for data of any dimension
+using NNWHierarchy = NNWHierarchyDim<Eigen::Dynamic>;
+//! NNW hierarchies for data of fixed dimension
+using NNW2Hierarchy = NNWHierarchyDim<2>;
+using NNW3Hierarchy = NNWHierarchyDim<3>;
+using NNW4Hierarchy = NNWHierarchyDim<4>;
+using NNW8Hierarchy = NNWHierarchyDim<8>;
+
+// The member functions are defined in nnw_hierarchy.cc, and instantiated
+// there for each of the dimensions above
+extern template class NNWHierarchyDim<Eigen::Dynamic>;
+extern template class NNWHierarchyDim<2>;
+extern template class NNWHierarchyDim<3>;
+extern template class NNWHierarchyDim<4>;
+extern template class NNWHierarchyDim<8>;
+
 #endif  // BAYESMIX_HIERARCHIES_NNW_HIERARCHY_H_
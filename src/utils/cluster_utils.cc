@@ -2,56 +2,455 @@
 
 #include <Eigen/Dense>
 #include <Eigen/SparseCore>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "lib/progressbar/progressbar.h"
 #include "proto_utils.h"
 
+namespace {
+//! Side of the square tiles in which the co-clustering counts are computed
+const int count_block = 128;
+
+//! Number of tiles in the upper triangle of the counts of n_data data
+int num_count_tiles(int n_data) {
+  int n_blocks = (n_data + count_block - 1) / count_block;
+  return n_blocks * (n_blocks + 1) / 2;
+}
+
+//! Group of data with the same label inside a block of a chain iteration
+struct Run {
+  int label;
+  int begin;  // first and past-the-end positions in the sorted members
+  int end;
+};
+
+//! Number of iterations represented by a chain whose rows have the given
+//! multiplicities (an empty vector means one per row)
+int total_weight(const Eigen::MatrixXi &alloc_chain,
+                 const Eigen::VectorXi &weights) {
+  return weights.size() ? weights.sum() : alloc_chain.rows();
+}
+
+//! Computes the co-clustering counts of the data tile by tile, and passes
+//! each tile of the upper triangle to f(tile, row0, col0, n_rows, n_cols,
+//! counts) as soon as it is complete. Tiles are processed in parallel, f must
+//! be safe to call concurrently on different tiles. Row t of the chain counts
+//! weights(t) times, or once if weights is empty.
+//! Counts are accumulated by cluster membership: in each iteration, each
+//! cluster of size n_k contributes to n_k^2 entries, for a total cost of
+//! O(T sum_k n_k^2) instead of O(T N^2). Each tile is filled by a single
+//! thread over all the iterations, so that its entries stay in cache. To this
+//! end the data of each iteration are sorted by label inside every block of
+//! rows.
+template <typename F>
+void for_each_count_tile(const Eigen::MatrixXi &alloc_chain,
+                         const Eigen::VectorXi &weights, F f) {
+  const int block = count_block;
+  int n_iter = alloc_chain.rows();
+  int n_data = alloc_chain.cols();
+  int n_blocks = (n_data + block - 1) / block;
+
+  // For every iteration and block: members sorted by label, and their runs
+  std::vector<int> members((long)n_iter * n_data);
+  std::vector<std::vector<Run>> runs(n_iter);
+  std::vector<int> run_start((long)n_iter * (n_blocks + 1));
+#pragma omp parallel for schedule(dynamic)
+  for (int t = 0; t < n_iter; t++) {
+    std::vector<std::pair<int, int>> sorted;
+    int *memb = &members[(long)t * n_data];
+    int *start = &run_start[(long)t * (n_blocks + 1)];
+    for (int b = 0; b < n_blocks; b++) {
+      start[b] = runs[t].size();
+      int first = b * block;
+      int last = std::min(n_data, first + block);
+      sorted.clear();
+      for (int i = first; i < last; i++) {
+        sorted.emplace_back(alloc_chain(t, i), i);
+      }
+      std::sort(sorted.begin(), sorted.end());
+      for (int p = 0; p < last - first; p++) {
+        memb[first + p] = sorted[p].second;
+        if (p == 0 or sorted[p].first != sorted[p - 1].first) {
+          runs[t].push_back({sorted[p].first, first + p, first + p + 1});
+        } else {
+          runs[t].back().end++;
+        }
+      }
+    }
+    start[n_blocks] = runs[t].size();
+  }
+
+  int n_tiles = num_count_tiles(n_data);
+#pragma omp parallel
+  {
+    Eigen::MatrixXi counts(block, block);
+#pragma omp for schedule(dynamic)
+    for (int tile = 0; tile < n_tiles; tile++) {
+      // tile -> (bi, bj) with bi <= bj, row by row
+      int bi = 0;
+      int rest = tile;
+      while (rest >= n_blocks - bi) {
+        rest -= n_blocks - bi;
+        bi++;
+      }
+      int bj = bi + rest;
+      int row0 = bi * block;
+      int col0 = bj * block;
+      int n_rows = std::min(n_data, row0 + block) - row0;
+      int n_cols = std::min(n_data, col0 + block) - col0;
+
+      counts.setZero();
+      for (int t = 0; t < n_iter; t++) {
+        int w = weights.size() ? weights(t) : 1;
+        const int *memb = &members[(long)t * n_data];
+        const int *start = &run_start[(long)t * (n_blocks + 1)];
+        const Run *r1 = runs[t].data() + start[bi];
+        const Run *end1 = runs[t].data() + start[bi + 1];
+        const Run *r2 = runs[t].data() + start[bj];
+        const Run *end2 = runs[t].data() + start[bj + 1];
+        // both lists of runs are sorted by label: merge them
+        while (r1 != end1 and r2 != end2) {
+          if (r1->label < r2->label) {
+            r1++;
+          } else if (r2->label < r1->label) {
+            r2++;
+          } else {
+            for (int q = r2->begin; q < r2->end; q++) {
+              int *col = counts.col(memb[q] - col0).data();
+              for (int p = r1->begin; p < r1->end; p++) {
+                col[memb[p] - row0] += w;
+              }
+            }
+            r1++;
+            r2++;
+          }
+        }
+      }
+      f(tile, row0, col0, n_rows, n_cols, counts);
+    }
+  }
+}
+}  // namespace
+
+Eigen::MatrixXf bayesmix::posterior_similarity(
+    const Eigen::MatrixXi &alloc_chain, const Eigen::VectorXi &weights) {
+  int n_data = alloc_chain.cols();
+  float scale = 1.0f / total_weight(alloc_chain, weights);
+  Eigen::MatrixXf psm(n_data, n_data);
+  for_each_count_tile(
+      alloc_chain, weights,
+      [&](int /*tile*/, int row0, int col0, int n_rows, int n_cols,
+          const Eigen::MatrixXi &counts) {
+        psm.block(row0, col0, n_rows, n_cols) =
+            counts.topLeftCorner(n_rows, n_cols).cast<float>() * scale;
+        if (row0 != col0) {
+          psm.block(col0, row0, n_cols, n_rows) =
+              psm.block(row0, col0, n_rows, n_cols).transpose();
+        }
+      });
+  return psm;
+}
+
 Eigen::MatrixXd bayesmix::posterior_similarity(
     const Eigen::MatrixXd &alloc_chain) {
-  unsigned int n_data = alloc_chain.cols();
-  Eigen::MatrixXd mean_diss = Eigen::MatrixXd::Zero(n_data, n_data);
-  // Loop over pairs (i,j) of data points
-  for (int i = 0; i < n_data; i++) {
-    for (int j = 0; j < i; j++) {
-      Eigen::ArrayXd diff = alloc_chain.col(i) - alloc_chain.col(j);
-      mean_diss(i, j) = (diff == 0).count();
+  Eigen::MatrixXi labels = alloc_chain.cast<int>();
+  return posterior_similarity(labels).cast<double>();
+}
+
+//! Labels are made canonical (0..K-1 in order of appearance) in parallel,
+//! then each partition is hashed and compared only with the distinct ones
+//! with the same hash.
+bayesmix::UniquePartitions bayesmix::unique_partitions(
+    const Eigen::MatrixXi &alloc_chain) {
+  int n_iter = alloc_chain.rows();
+  int n_data = alloc_chain.cols();
+  Eigen::MatrixXi canonical(n_iter, n_data);
+  std::vector<size_t> hashes(n_iter);
+#pragma omp parallel
+  {
+    std::unordered_map<int, int> relabel;
+#pragma omp for
+    for (int t = 0; t < n_iter; t++) {
+      relabel.clear();
+      size_t hash = 0;
+      for (int i = 0; i < n_data; i++) {
+        int label =
+            relabel.emplace(alloc_chain(t, i), (int)relabel.size()).first->second;
+        canonical(t, i) = label;
+        hash ^= std::hash<int>()(label) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+      }
+      hashes[t] = hash;
+    }
+  }
+
+  UniquePartitions unique;
+  unique.index.resize(n_iter);
+  std::vector<int> first;  // first iteration equal to each distinct partition
+  std::vector<int> counts;
+  std::unordered_multimap<size_t, int> seen;  // hash -> distinct partition
+  for (int t = 0; t < n_iter; t++) {
+    int found = -1;
+    auto range = seen.equal_range(hashes[t]);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (canonical.row(first[it->second]) == canonical.row(t)) {
+        found = it->second;
+        break;
+      }
+    }
+    if (found < 0) {
+      found = first.size();
+      seen.emplace(hashes[t], found);
+      first.push_back(t);
+      counts.push_back(0);
+    }
+    counts[found]++;
+    unique.index(t) = found;
+  }
+
+  int n_unique = first.size();
+  unique.partitions.resize(n_unique, n_data);
+  unique.counts.resize(n_unique);
+  unique.first.resize(n_unique);
+  for (int u = 0; u < n_unique; u++) {
+    unique.partitions.row(u) = canonical.row(first[u]);
+    unique.counts(u) = counts[u];
+    unique.first(u) = first[u];
+  }
+  return unique;
+}
+
+void bayesmix::DenseSimilarity::accumulate_row(
+    int i, const std::vector<int> &z, std::vector<double> &sums) const {
+  int n_groups = sums.size();
+  const float *col = psm.col(i).data();
+  for (int j = 0; j < n; j++) {
+    int l = z[j];
+    if (j != i and l >= 0 and l < n_groups) {
+      sums[l] += col[j];
     }
   }
-  return mean_diss / alloc_chain.rows();
 }
 
-//! \param coll Collector containing the algorithm chain
-//! \return     Index of the iteration containing the best estimate
+void bayesmix::DenseSimilarity::get_row(int i,
+                                        std::vector<float> &row) const {
+  row.assign(psm.col(i).data(), psm.col(i).data() + n);
+}
+
+bayesmix::PackedSimilarity::PackedSimilarity(
+    const Eigen::MatrixXi &alloc_chain, const Eigen::VectorXi &weights) {
+  n = alloc_chain.cols();
+  int n_iter = total_weight(alloc_chain, weights);
+  int max_count = std::numeric_limits<uint16_t>::max();
+  // counts are rescaled to 0..65535 only when they do not fit in 16 bits
+  int levels = std::min(n_iter, max_count);
+  scale = 1.0f / levels;
+  counts.resize((long)n * (n - 1) / 2);
+  for_each_count_tile(
+      alloc_chain, weights,
+      [&](int /*tile*/, int row0, int col0, int n_rows, int n_cols,
+          const Eigen::MatrixXi &tile_counts) {
+        for (int p = 0; p < n_rows; p++) {
+          int i = row0 + p;
+          for (int q = 0; q < n_cols; q++) {
+            int j = col0 + q;
+            if (j <= i) {
+              continue;
+            }
+            int c = tile_counts(p, q);
+            if (n_iter > max_count) {
+              c = (int)std::lround((double)c * max_count / n_iter);
+            }
+            counts[index(i, j)] = c;
+          }
+        }
+      });
+}
+
+void bayesmix::PackedSimilarity::accumulate_row(
+    int i, const std::vector<int> &z, std::vector<double> &sums) const {
+  int n_groups = sums.size();
+  // entries (j, i) with j < i lie in different rows of the triangle, entries
+  // (i, j) with j > i are contiguous
+  for (int j = 0; j < i; j++) {
+    int l = z[j];
+    if (l >= 0 and l < n_groups) {
+      sums[l] += scale * counts[index(j, i)];
+    }
+  }
+  const uint16_t *row = counts.data() + (i + 1 < n ? index(i, i + 1) : 0);
+  for (int j = i + 1; j < n; j++) {
+    int l = z[j];
+    if (l >= 0 and l < n_groups) {
+      sums[l] += scale * row[j - i - 1];
+    }
+  }
+}
+
+void bayesmix::PackedSimilarity::get_row(int i,
+                                         std::vector<float> &row) const {
+  row.resize(n);
+  for (int j = 0; j < i; j++) {
+    row[j] = scale * counts[index(j, i)];
+  }
+  row[i] = 1.0f;
+  const uint16_t *upper = counts.data() + (i + 1 < n ? index(i, i + 1) : 0);
+  for (int j = i + 1; j < n; j++) {
+    row[j] = scale * upper[j - i - 1];
+  }
+}
+
+bayesmix::SparseSimilarity::SparseSimilarity(
+    const Eigen::MatrixXi &alloc_chain, float threshold,
+    const Eigen::VectorXi &weights) {
+  n = alloc_chain.cols();
+  float scale = 1.0f / total_weight(alloc_chain, weights);
+  // each tile only writes its own list of entries, both (i, j) and (j, i)
+  std::vector<std::vector<Eigen::Triplet<float>>> entries(
+      num_count_tiles(n));
+  for_each_count_tile(
+      alloc_chain, weights,
+      [&](int tile, int row0, int col0, int n_rows, int n_cols,
+          const Eigen::MatrixXi &tile_counts) {
+        for (int q = 0; q < n_cols; q++) {
+          int j = col0 + q;
+          for (int p = 0; p < n_rows; p++) {
+            int i = row0 + p;
+            float value = tile_counts(p, q) * scale;
+            if (i < j and value > threshold) {
+              entries[tile].emplace_back(i, j, value);
+              entries[tile].emplace_back(j, i, value);
+            }
+          }
+        }
+      });
+
+  std::vector<Eigen::Triplet<float>> all;
+  size_t n_entries = 0;
+  for (auto &e : entries) {
+    n_entries += e.size();
+  }
+  all.reserve(n_entries);
+  for (auto &e : entries) {
+    all.insert(all.end(), e.begin(), e.end());
+    std::vector<Eigen::Triplet<float>>().swap(e);
+  }
+  psm.resize(n, n);
+  psm.setFromTriplets(all.begin(), all.end());
+}
+
+float bayesmix::SparseSimilarity::operator()(int i, int j) const {
+  if (i == j) {
+    return 1.0f;
+  }
+  return psm.coeff(i, j);
+}
+
+void bayesmix::SparseSimilarity::accumulate_row(
+    int i, const std::vector<int> &z, std::vector<double> &sums) const {
+  int n_groups = sums.size();
+  for (Eigen::SparseMatrix<float, Eigen::RowMajor>::InnerIterator it(psm, i);
+       it; ++it) {
+    int l = z[it.col()];
+    if (l >= 0 and l < n_groups) {
+      sums[l] += it.value();
+    }
+  }
+}
+
+void bayesmix::SparseSimilarity::get_row(int i,
+                                         std::vector<float> &row) const {
+  row.assign(n, 0.0f);
+  row[i] = 1.0f;
+  for (Eigen::SparseMatrix<float, Eigen::RowMajor>::InnerIterator it(psm, i);
+       it; ++it) {
+    row[it.col()] = it.value();
+  }
+}
+
+std::unique_ptr<bayesmix::SimilarityMatrix> bayesmix::posterior_similarity(
+    const Eigen::MatrixXi &alloc_chain, SimilarityStorage storage,
+    float threshold, const Eigen::VectorXi &weights) {
+  switch (storage) {
+    case SimilarityStorage::dense:
+      return std::make_unique<DenseSimilarity>(
+          posterior_similarity(alloc_chain, weights));
+    case SimilarityStorage::packed:
+      return std::make_unique<PackedSimilarity>(alloc_chain, weights);
+    case SimilarityStorage::sparse:
+      return std::make_unique<SparseSimilarity>(alloc_chain, threshold,
+                                                weights);
+    default:
+      throw std::invalid_argument("Unknown similarity storage");
+  }
+}
+
+//! With x_ij the co-clustering indicator of an iteration and p_ij the PSM, the
+//! squared error sum_{i<j} (x_ij - p_ij)^2 equals
+//!   sum_{i<j} p_ij^2 + sum_{i<j: x_ij = 1} (1 - 2 p_ij),
+//! where the first term is shared by all iterations. Only the pairs within
+//! the clusters of each iteration are visited, i.e. O(sum_k n_k^2) work.
+//! \param alloc_chain Allocations chain, one iteration per row
+//! \return            Iteration with the least error, i.e. the best estimate
 Eigen::VectorXd bayesmix::cluster_estimate(
     const Eigen::MatrixXd &alloc_chain) {
-  // Initialize objects
-  unsigned n_iter = alloc_chain.rows();
-  unsigned int n_data = alloc_chain.cols();
-  std::vector<Eigen::SparseMatrix<double> > all_diss;
+  // Initialize objects, on the distinct partitions of the chain
+  Eigen::MatrixXi chain = alloc_chain.cast<int>();
+  bayesmix::UniquePartitions unique = bayesmix::unique_partitions(chain);
+  const Eigen::MatrixXi &labels = unique.partitions;
+  int n_iter = labels.rows();
+  int n_data = labels.cols();
   progresscpp::ProgressBar bar(n_iter, 60);
 
-  // Compute mean
+  // Compute mean, in 16 bits over the upper triangle
   std::cout << "(Computing mean dissimilarity... " << std::flush;
-  Eigen::MatrixXd mean_diss = bayesmix::posterior_similarity(alloc_chain);
+  bayesmix::PackedSimilarity mean_diss(labels, unique.counts);
   std::cout << "Done)" << std::endl;
 
-  // Compute Frobenius norm error of all iterations
-  Eigen::VectorXd errors(n_iter);
-  for (int k = 0; k < n_iter; k++) {
-    for (int i = 0; i < n_data; i++) {
-      for (int j = 0; j < i; j++) {
-        int x = (alloc_chain(k, i) == alloc_chain(k, j));
-        errors(k) += (x - mean_diss(i, j)) * (x - mean_diss(i, j));
+  // Compute Frobenius norm error of all iterations, up to the shared term
+  Eigen::VectorXd errors = Eigen::VectorXd::Zero(n_iter);
+#pragma omp parallel
+  {
+    std::vector<std::pair<int, int>> sorted(n_data);
+#pragma omp for schedule(dynamic)
+    for (int k = 0; k < n_iter; k++) {
+      // data sorted by cluster, and by index inside each cluster
+      for (int i = 0; i < n_data; i++) {
+        sorted[i] = std::make_pair(labels(k, i), i);
+      }
+      std::sort(sorted.begin(), sorted.end());
+      double error = 0.0;
+      int first = 0;
+      for (int last = 1; last <= n_data; last++) {
+        if (last < n_data and sorted[last].first == sorted[first].first) {
+          continue;
+        }
+        for (int p = first; p < last; p++) {
+          int i = sorted[p].second;
+          for (int q = p + 1; q < last; q++) {
+            error += 1.0 - 2.0 * mean_diss(i, sorted[q].second);
+          }
+        }
+        first = last;
+      }
+      errors(k) = error;
+      // Progress bar
+#pragma omp critical
+      {
+        ++bar;
+        bar.display();
       }
     }
-    // Progress bar
-    ++bar;
-    bar.display();
   }
   bar.done();
 
   // Find iteration with the least error
   std::ptrdiff_t ibest;
-  unsigned int min_err = errors.minCoeff(&ibest);
-  return alloc_chain.row(ibest).transpose();
+  errors.minCoeff(&ibest);
+  return alloc_chain.row(unique.first(ibest)).transpose();
 }
@@ -2,10 +2,125 @@
 #define BAYESMIX_UTILS_CLUSTER_UTILS_H_
 
 #include <Eigen/Dense>
+#include <Eigen/SparseCore>
+#include <cstdint>
+#include <memory>
+#include <vector>
 
 namespace bayesmix {
-//! Computes the posterior similarity matrix the data
+//! Distinct partitions of an allocations chain, with their multiplicities
+struct UniquePartitions {
+  //! One distinct partition per row, labeled 0..K-1 in order of appearance
+  Eigen::MatrixXi partitions;
+  //! Number of iterations of the chain equal to each distinct partition
+  Eigen::VectorXi counts;
+  //! First iteration of the chain equal to each distinct partition
+  Eigen::VectorXi first;
+  //! Distinct partition equal to each iteration of the chain
+  Eigen::VectorXi index;
+};
+
+//! Collapses the iterations of an allocations chain (T x N) that give the
+//! same partition of the data, up to a relabeling
+UniquePartitions unique_partitions(const Eigen::MatrixXi &alloc_chain);
+
+//! Computes the (symmetric) posterior similarity matrix of the data, given
+//! the allocations chain as a T x N matrix of integer labels. If given, the
+//! weights are the multiplicities of the rows of the chain.
+Eigen::MatrixXf posterior_similarity(
+    const Eigen::MatrixXi &alloc_chain,
+    const Eigen::VectorXi &weights = Eigen::VectorXi());
+//! Same as above, for allocations stored as doubles
 Eigen::MatrixXd posterior_similarity(const Eigen::MatrixXd &alloc_chain);
+
+//! Storage of a posterior similarity matrix (PSM). A dense float matrix needs
+//! 4 N^2 bytes; the packed upper triangle of 16-bit counts needs N^2 bytes,
+//! and the sparse storage only keeps the entries above a threshold.
+//! These bounds only cover the PSM itself: while it is computed, the data of
+//! every iteration are also kept sorted by label, which takes O(T N) working
+//! memory on top of the chain.
+enum class SimilarityStorage { dense, packed, sparse };
+
+//! Posterior similarity matrix with memory-bounded storage, accessed by rows
+class SimilarityMatrix {
+ public:
+  virtual ~SimilarityMatrix() = default;
+  //! Returns the number of data
+  int size() const { return n; }
+  //! Returns entry (i, j) of the matrix
+  virtual float operator()(int i, int j) const = 0;
+  //! Adds p_ij to sums[z[j]] for every j != i with 0 <= z[j] < sums.size()
+  virtual void accumulate_row(int i, const std::vector<int> &z,
+                              std::vector<double> &sums) const = 0;
+  //! Copies row i of the matrix into "row", resized to N
+  virtual void get_row(int i, std::vector<float> &row) const = 0;
+
+ protected:
+  int n;
+};
+
+//! Full N x N matrix in single precision
+class DenseSimilarity : public SimilarityMatrix {
+ public:
+  DenseSimilarity(Eigen::MatrixXf psm_) : psm(std::move(psm_)) {
+    n = psm.rows();
+  }
+  float operator()(int i, int j) const override { return psm(i, j); }
+  void accumulate_row(int i, const std::vector<int> &z,
+                      std::vector<double> &sums) const override;
+  void get_row(int i, std::vector<float> &row) const override;
+
+ protected:
+  Eigen::MatrixXf psm;
+};
+
+//! Co-clustering counts over the packed strict upper triangle, in 16 bits.
+//! With more than 65535 iterations counts are rescaled to 0..65535, i.e.
+//! frequencies are rounded to the nearest multiple of 1/65535.
+class PackedSimilarity : public SimilarityMatrix {
+ public:
+  PackedSimilarity(const Eigen::MatrixXi &alloc_chain,
+                   const Eigen::VectorXi &weights = Eigen::VectorXi());
+  float operator()(int i, int j) const override {
+    if (i == j) return 1.0f;
+    return scale * (i < j ? counts[index(i, j)] : counts[index(j, i)]);
+  }
+  void accumulate_row(int i, const std::vector<int> &z,
+                      std::vector<double> &sums) const override;
+  void get_row(int i, std::vector<float> &row) const override;
+
+ protected:
+  //! Position of entry (i, j), i < j, in the row-major packed triangle
+  long index(int i, int j) const {
+    return (long)i * (2L * n - i - 1) / 2 + (j - i - 1);
+  }
+  std::vector<uint16_t> counts;
+  float scale;
+};
+
+//! Only the off-diagonal entries greater than a threshold, stored by rows
+class SparseSimilarity : public SimilarityMatrix {
+ public:
+  SparseSimilarity(const Eigen::MatrixXi &alloc_chain, float threshold,
+                   const Eigen::VectorXi &weights = Eigen::VectorXi());
+  float operator()(int i, int j) const override;
+  void accumulate_row(int i, const std::vector<int> &z,
+                      std::vector<double> &sums) const override;
+  void get_row(int i, std::vector<float> &row) const override;
+  //! Returns the number of stored entries
+  long nonzeros() const { return psm.nonZeros(); }
+
+ protected:
+  Eigen::SparseMatrix<float, Eigen::RowMajor> psm;
+};
+
+//! Computes the posterior similarity matrix with the given storage. The
+//! threshold is only used by the sparse storage.
+std::unique_ptr<SimilarityMatrix> posterior_similarity(
+    const Eigen::MatrixXi &alloc_chain, SimilarityStorage storage,
+    float threshold = 0.0f,
+    const Eigen::VectorXi &weights = Eigen::VectorXi());
+
 //! Estimates the clustering structure of the data via LS minimization
 Eigen::VectorXd cluster_estimate(const Eigen::MatrixXd &alloc_chain);
 }  // namespace bayesmix
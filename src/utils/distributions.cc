@@ -21,6 +21,36 @@ double bayesmix::multi_normal_prec_lpdf(const Eigen::VectorXd &datum,
   return 0.5 * (base - exp);
 }
 
+Eigen::VectorXd bayesmix::multi_normal_prec_lpdf_grid(
+    const Eigen::MatrixXd &data, const Eigen::VectorXd &mean,
+    const Eigen::MatrixXd &prec_chol, double prec_logdet) {
+  using stan::math::NEG_LOG_SQRT_TWO_PI;
+  double base = prec_logdet + NEG_LOG_SQRT_TWO_PI * data.cols();
+  // All the points are transformed at once, as a matrix-matrix product
+  Eigen::MatrixXd transformed =
+      (data.rowwise() - mean.transpose()) * prec_chol.transpose();
+  return 0.5 * (base - transformed.rowwise().squaredNorm().array());
+}
+
+double bayesmix::student_t_log_const(double deg_free) {
+  return stan::math::lgamma(0.5 * (deg_free + 1)) -
+         stan::math::lgamma(0.5 * deg_free) -
+         0.5 * (std::log(deg_free) + stan::math::LOG_PI);
+}
+
+void bayesmix::wishart_bartlett_rng(double deg_free, std::mt19937_64 &rng,
+                                    Eigen::Ref<Eigen::MatrixXd> bartlett) {
+  size_t dim = bartlett.rows();
+  bartlett.setZero();
+  for (size_t i = 0; i < dim; i++) {
+    double dof = deg_free - dim + 1 + i;
+    bartlett(i, i) = std::sqrt(stan::math::chi_square_rng(dof, rng));
+    for (size_t j = i + 1; j < dim; j++) {
+      bartlett(i, j) = stan::math::normal_rng(0.0, 1.0, rng);
+    }
+  }
+}
+
 double bayesmix::gaussian_mixture_dist(
     Eigen::VectorXd means1, Eigen::VectorXd vars1, Eigen::VectorXd weights1,
     Eigen::VectorXd means2, Eigen::VectorXd vars2, Eigen::VectorXd weights2) {
@@ -141,6 +171,24 @@ double bayesmix::gaussian_mixture_dist(
       precs2.push_back(bayesmix::to_eigen(c.multi_ls_state().prec()));
     }
 
+    out = gaussian_mixture_dist(means1, precs1, weights1, means2, precs2,
+                                weights2);
+  } else if (clus1[0].has_diag_ls_state()) {
+    std::vector<Eigen::VectorXd> means1, means2;
+    std::vector<Eigen::MatrixXd> precs1, precs2;
+
+    for (const auto &c : clus1) {
+      means1.push_back(bayesmix::to_eigen(c.diag_ls_state().mean()));
+      Eigen::VectorXd var = bayesmix::to_eigen(c.diag_ls_state().var());
+      precs1.push_back(var.cwiseInverse().asDiagonal());
+    }
+
+    for (const auto &c : clus2) {
+      means2.push_back(bayesmix::to_eigen(c.diag_ls_state().mean()));
+      Eigen::VectorXd var = bayesmix::to_eigen(c.diag_ls_state().var());
+      precs2.push_back(var.cwiseInverse().asDiagonal());
+    }
+
     out = gaussian_mixture_dist(means1, precs1, weights1, means2, precs2,
                                 weights2);
   } else {
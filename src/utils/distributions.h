@@ -39,6 +39,50 @@ double multi_normal_prec_lpdf(const Eigen::VectorXd &datum,
                               const Eigen::MatrixXd &prec_chol,
                               double prec_logdet);
 
+/*
+ * Evaluates the log probability density function of a multivariate Gaussian
+ * distribution parametrized by mean and precision matrix on multiple points
+ *
+ * @param data where to evaluate the the lpdf, one point per row
+ * @param mean the mean of the Gaussian distribution
+ * @prec_chol the (lower) cholesky factor of the precision matric
+ * @prec_logdet logarithm of the determinant of the precision matrix
+ * @return the evaluation of the lpdf on each row of data
+ */
+Eigen::VectorXd multi_normal_prec_lpdf_grid(const Eigen::MatrixXd &data,
+                                            const Eigen::VectorXd &mean,
+                                            const Eigen::MatrixXd &prec_chol,
+                                            double prec_logdet);
+
+/*
+ * Evaluates the part of the log probability density function of a
+ * univariate Student's t distribution that only depends on the degrees of
+ * freedom nu, i.e. lgamma((nu + 1) / 2) - lgamma(nu / 2) - log(nu pi) / 2.
+ * The full lpdf in x, for location mu and scale sigma, is this constant
+ * minus log(sigma) + (nu + 1) / 2 * log(1 + (x - mu)^2 / (nu sigma^2))
+ *
+ * @param deg_free the degrees of freedom nu, > 0
+ * @return the constant part of the lpdf
+ */
+double student_t_log_const(double deg_free);
+
+/*
+ * Generates the Cholesky factor of a Wishart random matrix with identity
+ * scale, via the Bartlett decomposition: B is upper triangular, with
+ * B(i, i)^2 ~ chi-squared(deg_free - dim + 1 + i) and B(i, j) ~ N(0, 1) for
+ * j > i. If U is upper triangular, (U B) (U B)^T ~ Wishart(deg_free, U U^T),
+ * so that the factor of a draw is obtained without any factorization.
+ * The factor is written into the given matrix, which may have a fixed size,
+ * so that no memory is allocated
+ *
+ * @param deg_free the degrees of freedom, > dim - 1
+ * @param rng random number generator
+ * @param bartlett dim x dim matrix, overwritten with an upper triangular B
+ * such that B B^T ~ Wishart(deg_free, I)
+ */
+void wishart_bartlett_rng(double deg_free, std::mt19937_64 &rng,
+                          Eigen::Ref<Eigen::MatrixXd> bartlett);
+
 /*
  * Computes the L2 distance between the univariate mixture of Gaussian
  * densities p1(x) = \sum_{h=1}^m1 w1[h] N(x | mean1[h], var1[h]) and
@@ -0,0 +1,517 @@
+#include <gtest/gtest.h>
+
+#include <Eigen/Dense>
+#include <cmath>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "src/clustering/ClusterEstimator.hpp"
+#include "src/clustering/lossfunction/BinderLoss.hpp"
+#include "src/clustering/lossfunction/CompactPartitions.hpp"
+#include "src/clustering/lossfunction/VariationInformation.hpp"
+#include "src/clustering/uncertainty/CredibleBall.hpp"
+#include "src/utils/cluster_utils.h"
+#include "src/utils/rng.h"
+
+namespace {
+//! Entropy of the empirical distribution of the given labels, in bits
+template <typename Label>
+double entropy(const std::vector<Label> &labels) {
+  std::map<Label, int> counts;
+  for (auto &l : labels) counts[l]++;
+  double h = 0.0;
+  for (auto &c : counts) {
+    double p = (double)c.second / labels.size();
+    h -= p * std::log2(p);
+  }
+  return h;
+}
+
+Eigen::VectorXi random_partition(int n, int k, int scale = 1) {
+  return Eigen::VectorXi::Random(n).unaryExpr(
+      [k, scale](int x) { return (std::abs(x) % k) * scale; });
+}
+
+//! Noisy copies of a partition with k groups, one per row
+Eigen::MatrixXi random_sample(int t, int n, int k) {
+  Eigen::VectorXi base = random_partition(n, k);
+  Eigen::MatrixXi sample(t, n);
+  for (int i = 0; i < t; i++) {
+    Eigen::VectorXi noise = random_partition(n, 4 * k);
+    for (int j = 0; j < n; j++) {
+      sample(i, j) = (noise(j) < k) ? noise(j) : base(j);
+    }
+  }
+  return sample;
+}
+}  // namespace
+
+TEST(binder_loss, small_example) {
+  Eigen::VectorXi c1(5);
+  c1 << 1, 1, 1, 2, 3;
+  Eigen::VectorXi c2(5);
+  c2 << 1, 1, 2, 2, 2;
+
+  BinderLoss binder_loss(1.0, 1.0);
+  binder_loss.SetCluster(c1, c2);
+  ASSERT_DOUBLE_EQ(binder_loss.Loss(), 5.0);
+}
+
+TEST(binder_loss, pairwise_definition) {
+  int n = 200;
+  double l1 = 1.0;
+  double l2 = 2.5;
+  Eigen::VectorXi c1 = random_partition(n, 7);
+  // labels far apart from each other
+  Eigen::VectorXi c2 = random_partition(n, 5, 100000);
+
+  double expected = 0.0;
+  for (int i = 0; i < n; i++) {
+    for (int j = i + 1; j < n; j++) {
+      bool same1 = (c1(i) == c1(j));
+      bool same2 = (c2(i) == c2(j));
+      expected += l1 * (!same1 && same2) + l2 * (same1 && !same2);
+    }
+  }
+
+  BinderLoss binder_loss(l1, l2);
+  binder_loss.SetCluster(c1, c2);
+  ASSERT_DOUBLE_EQ(binder_loss.Loss(), expected);
+}
+
+TEST(variation_information, definition) {
+  int n = 300;
+  Eigen::VectorXi c1 = random_partition(n, 6);
+  Eigen::VectorXi c2 = random_partition(n, 40, 1000);
+
+  std::vector<int> l1(c1.data(), c1.data() + n);
+  std::vector<int> l2(c2.data(), c2.data() + n);
+  std::vector<std::pair<int, int>> l12;
+  for (int i = 0; i < n; i++) l12.emplace_back(c1(i), c2(i));
+  double h1 = entropy(l1);
+  double h2 = entropy(l2);
+  double h12 = entropy(l12);
+
+  VariationInformation vi(false);
+  vi.SetCluster(c1, c2);
+  ASSERT_NEAR(vi.Loss(), 2 * h12 - h1 - h2, 1e-10);
+  ASSERT_NEAR(vi.JointEntropy(), h12, 1e-10);
+  ASSERT_NEAR(vi.Entropy(c1), h1, 1e-10);
+
+  VariationInformation vi_norm(true);
+  vi_norm.SetCluster(c1, c2);
+  ASSERT_NEAR(vi_norm.Loss(), 1 - (h1 + h2 - h12) / h12, 1e-10);
+
+  vi.SetCluster(c1, c1);
+  ASSERT_NEAR(vi.Loss(), 0.0, 1e-10);
+}
+
+TEST(cluster_estimator, greedy_local_minimum) {
+  int n = 30;
+  int k_up = 5;
+  Eigen::MatrixXi sample = random_sample(20, n, 3);
+  for (auto loss : {BINDER_LOSS, VARIATION_INFORMATION,
+                    VARIATION_INFORMATION_NORMALIZED,
+                    VARIATION_INFORMATION_LOWER_BOUND}) {
+    Eigen::VectorXi init = Eigen::VectorXi::LinSpaced(n, 1, n);
+    ClusterEstimator estimator(sample, loss, k_up, init);
+    Eigen::VectorXi estimate = estimator.cluster_estimate(GREEDY);
+    ASSERT_LE(estimate.maxCoeff(), k_up);
+
+    // no single relabeling improves the expected posterior loss
+    double epl = estimator.expected_posterior_loss(estimate);
+    for (int i = 0; i < n; i++) {
+      Eigen::VectorXi moved = estimate;
+      for (int s = 1; s <= k_up; s++) {
+        moved(i) = s;
+        ASSERT_GE(estimator.expected_posterior_loss(moved), epl - 1e-9);
+      }
+    }
+  }
+}
+
+TEST(loss_function, loss_against_sample) {
+  int n = 50;
+  Eigen::MatrixXi sample = random_sample(40, n, 4);
+  Eigen::VectorXi a = random_partition(n, 3);
+  VariationInformation vi(false);
+  Eigen::VectorXd losses = vi.LossAgainstSample(a, sample);
+  ASSERT_EQ(losses.size(), sample.rows());
+  for (int t = 0; t < sample.rows(); t++) {
+    vi.SetCluster(a, sample.row(t));
+    ASSERT_DOUBLE_EQ(losses(t), vi.Loss());
+  }
+}
+
+TEST(cluster_utils, posterior_similarity) {
+  // more data than a tile, and labels far apart from each other
+  int n = 300;
+  int t = 25;
+  Eigen::MatrixXi sample = random_sample(t, n, 5) * 1000;
+  Eigen::MatrixXf psm = bayesmix::posterior_similarity(sample);
+  ASSERT_EQ(psm.rows(), n);
+  ASSERT_EQ(psm.cols(), n);
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      int count = 0;
+      for (int k = 0; k < t; k++) count += (sample(k, i) == sample(k, j));
+      ASSERT_FLOAT_EQ(psm(i, j), (float)count / t);
+    }
+  }
+}
+
+TEST(cluster_utils, similarity_storage) {
+  int n = 200;
+  Eigen::MatrixXi sample = random_sample(30, n, 4);
+  Eigen::MatrixXf dense = bayesmix::posterior_similarity(sample);
+  auto packed = bayesmix::posterior_similarity(
+      sample, bayesmix::SimilarityStorage::packed);
+  float threshold = 0.5f;
+  auto sparse = bayesmix::posterior_similarity(
+      sample, bayesmix::SimilarityStorage::sparse, threshold);
+
+  std::vector<int> z(n);
+  for (int j = 0; j < n; j++) z[j] = j % 3;
+  for (int i = 0; i < n; i++) {
+    std::vector<double> expected(3, 0.0), expected_sparse(3, 0.0);
+    for (int j = 0; j < n; j++) {
+      ASSERT_FLOAT_EQ((*packed)(i, j), dense(i, j));
+      float value = (i == j or dense(i, j) > threshold) ? dense(i, j) : 0.0f;
+      ASSERT_FLOAT_EQ((*sparse)(i, j), value);
+      if (j != i) {
+        expected[z[j]] += dense(i, j);
+        expected_sparse[z[j]] += value;
+      }
+    }
+    std::vector<double> sums(3, 0.0), sums_sparse(3, 0.0);
+    packed->accumulate_row(i, z, sums);
+    sparse->accumulate_row(i, z, sums_sparse);
+    for (int l = 0; l < 3; l++) {
+      ASSERT_NEAR(sums[l], expected[l], 1e-4);
+      ASSERT_NEAR(sums_sparse[l], expected_sparse[l], 1e-4);
+    }
+  }
+
+  // without threshold, all storages lead to the same Binder estimate
+  Eigen::VectorXi init = Eigen::VectorXi::LinSpaced(n, 1, n);
+  std::vector<Eigen::VectorXi> estimates;
+  for (auto storage :
+       {bayesmix::SimilarityStorage::dense, bayesmix::SimilarityStorage::packed,
+        bayesmix::SimilarityStorage::sparse}) {
+    bayesmix::Rng::Instance().seed(20201124);
+    ClusterEstimator estimator(sample, BINDER_LOSS, 6, init, storage);
+    estimates.push_back(estimator.cluster_estimate(GREEDY));
+  }
+  ASSERT_EQ(estimates[0], estimates[1]);
+  ASSERT_EQ(estimates[0], estimates[2]);
+}
+
+TEST(cluster_utils, cluster_estimate) {
+  int n = 60;
+  int t = 40;
+  Eigen::MatrixXi sample = random_sample(t, n, 3);
+  Eigen::MatrixXf psm = bayesmix::posterior_similarity(sample);
+
+  // iteration with the least squared distance from the PSM
+  int best = 0;
+  double best_error = INFINITY;
+  for (int k = 0; k < t; k++) {
+    double error = 0.0;
+    for (int i = 0; i < n; i++) {
+      for (int j = 0; j < i; j++) {
+        double x = (sample(k, i) == sample(k, j));
+        error += (x - psm(i, j)) * (x - psm(i, j));
+      }
+    }
+    if (error < best_error) {
+      best_error = error;
+      best = k;
+    }
+  }
+
+  Eigen::VectorXd estimate =
+      bayesmix::cluster_estimate(sample.cast<double>().eval());
+  ASSERT_EQ(estimate, sample.row(best).transpose().cast<double>());
+}
+
+TEST(cluster_estimator, multi_start) {
+  int n = 40;
+  int k_up = 4;
+  Eigen::MatrixXi sample = random_sample(20, n, 3);
+  for (auto loss : {BINDER_LOSS, VARIATION_INFORMATION}) {
+    Eigen::VectorXi init = Eigen::VectorXi::LinSpaced(n, 1, n);
+    ClusterEstimator estimator(sample, loss, k_up, init);
+    estimator.set_multi_start(9, 60.0);
+    bayesmix::Rng::Instance().seed(20201124);
+    Eigen::VectorXi estimate = estimator.cluster_estimate(MULTI_START);
+    ASSERT_LE(estimate.maxCoeff(), k_up);
+
+    // the same seed gives the same estimate
+    bayesmix::Rng::Instance().seed(20201124);
+    ASSERT_EQ(estimator.cluster_estimate(MULTI_START), estimate);
+
+    double epl = estimator.expected_posterior_loss(estimate);
+    for (int i = 0; i < n; i++) {
+      Eigen::VectorXi moved = estimate;
+      for (int s = 1; s <= k_up; s++) {
+        moved(i) = s;
+        ASSERT_GE(estimator.expected_posterior_loss(moved), epl - 1e-9);
+      }
+    }
+  }
+}
+
+TEST(cluster_estimator, multi_start_no_time) {
+  // with no time left, the start from the initial partition still completes
+  // a sweep, which removes its labels > k_up
+  int n = 40;
+  int k_up = 4;
+  Eigen::MatrixXi sample = random_sample(20, n, 3);
+  Eigen::VectorXi init = Eigen::VectorXi::LinSpaced(n, 1, n);
+  ClusterEstimator estimator(sample, VARIATION_INFORMATION, k_up, init);
+  estimator.set_multi_start(9, 0.0);
+  Eigen::VectorXi estimate = estimator.cluster_estimate(MULTI_START);
+  ASSERT_LE(estimate.maxCoeff(), k_up);
+}
+
+TEST(cluster_estimator, greedy_fewer_labels) {
+  // the starting partition uses fewer labels than k_up, so that the sweeps
+  // also try the labels it does not use
+  int n = 30;
+  int k_up = 5;
+  Eigen::MatrixXi sample = random_sample(20, n, 3);
+  Eigen::VectorXi init = Eigen::VectorXi::Ones(n);
+  ClusterEstimator estimator(sample, VARIATION_INFORMATION, k_up, init);
+  Eigen::VectorXi estimate = estimator.cluster_estimate(GREEDY);
+  ASSERT_LE(estimate.maxCoeff(), k_up);
+
+  // no move to any of the k_up labels, used or not, improves the loss
+  double epl = estimator.expected_posterior_loss(estimate);
+  for (int i = 0; i < n; i++) {
+    Eigen::VectorXi moved = estimate;
+    for (int s = 1; s <= k_up; s++) {
+      moved(i) = s;
+      ASSERT_GE(estimator.expected_posterior_loss(moved), epl - 1e-9);
+    }
+  }
+}
+
+TEST(credible_ball, radius_is_quantile) {
+  int n = 30;
+  int t = 100;
+  Eigen::MatrixXi sample = random_sample(t, n, 3);
+  Eigen::VectorXi estimate = sample.row(0);
+  double alpha = 0.05;
+  CredibleBall ball(VARIATION_INFORMATION, sample, alpha, estimate);
+  double radius = ball.calculateRegion();
+
+  VariationInformation vi(false);
+  Eigen::VectorXd losses = vi.LossAgainstSample(estimate, sample);
+  int inside = (losses.array() <= radius).count();
+  int strictly_inside = (losses.array() < radius).count();
+  // smallest radius with at least 1 - alpha of the samples inside the ball
+  ASSERT_GE(inside, (1 - alpha) * t);
+  ASSERT_LT(strictly_inside, (1 - alpha) * t);
+
+  // the horizontal bound is made of the farthest samples in the ball
+  Eigen::VectorXi hb = ball.HorizontalBound();
+  ASSERT_GT(hb.size(), 0);
+  for (int i = 0; i < hb.size(); i++) {
+    ASSERT_DOUBLE_EQ(losses(hb(i)), radius);
+  }
+
+  // vertical bounds: farthest samples in the ball among those with the
+  // least (upper) or the most (lower) clusters
+  std::vector<int> card(t);
+  int min_card = n;
+  int max_card = 0;
+  for (int k = 0; k < t; k++) {
+    std::set<int> labels;
+    for (int j = 0; j < n; j++) labels.insert(sample(k, j));
+    card[k] = labels.size();
+    ASSERT_EQ(ball.count_cluster_row(k), card[k]);
+    if (losses(k) <= radius) {
+      min_card = std::min(min_card, card[k]);
+      max_card = std::max(max_card, card[k]);
+    }
+  }
+  for (auto bound : {std::make_pair(ball.VerticalUpperBound(), min_card),
+                     std::make_pair(ball.VerticalLowerBound(), max_card)}) {
+    double farthest = -1.0;
+    std::vector<int> expected;
+    for (int k = t - 1; k >= 0; k--) {
+      if (losses(k) > radius or card[k] != bound.second) continue;
+      if (losses(k) > farthest) expected.clear();
+      farthest = std::max(farthest, losses(k));
+      if (losses(k) == farthest) expected.push_back(k);
+    }
+    std::vector<int> members(bound.first.data(),
+                             bound.first.data() + bound.first.size());
+    ASSERT_EQ(members, expected);
+  }
+}
+
+TEST(cluster_estimator, epl_for_each_k) {
+  int n = 25;
+  Eigen::MatrixXi sample = random_sample(20, n, 3);
+  Eigen::VectorXi init = Eigen::VectorXi::LinSpaced(n, 1, n);
+  ClusterEstimator estimator(sample, VARIATION_INFORMATION, n, init);
+  Eigen::VectorXd epl = estimator.epl_for_each_K();
+  ASSERT_EQ(epl.size(), n);
+  // all data in a single cluster
+  Eigen::VectorXi ones = Eigen::VectorXi::Ones(n);
+  ASSERT_NEAR(epl(0), estimator.expected_posterior_loss(ones), 1e-12);
+  for (int k = 1; k < n; k++) {
+    ASSERT_LE(epl(k), epl(k - 1) + 1e-12);
+  }
+
+  // every K is also started from the initial partition, so the scan is not
+  // worse than a greedy run for that K alone (with K above the 3 groups of
+  // the sample, where the greedy algorithm does not get stuck)
+  for (int k : {5, 9, 13}) {
+    Eigen::VectorXi init_k = init;
+    ClusterEstimator single(sample, VARIATION_INFORMATION, k, init_k);
+    Eigen::VectorXi a = single.greedy_algorithm(init_k);
+    ASSERT_LE(epl(k - 1), single.expected_posterior_loss(a) + 1e-12);
+  }
+
+  // an infinite tolerance stops after the first flat block, whatever the
+  // number of threads: the blocks hold 8 values of K
+  Eigen::VectorXd partial = estimator.epl_for_each_K(INFINITY, 1);
+  ASSERT_EQ(partial.size(), 16);
+}
+
+TEST(cluster_estimator, epl_for_each_k_warm_start) {
+  // with k_up > 8 the later blocks are also warm-started from the best
+  // partition of the first block, which has far fewer than K groups
+  int n = 30;
+  int k_up = 20;
+  Eigen::MatrixXi sample = random_sample(20, n, 3);
+  Eigen::VectorXi init = Eigen::VectorXi::LinSpaced(n, 1, n);
+  ClusterEstimator estimator(sample, VARIATION_INFORMATION, k_up, init);
+  Eigen::VectorXd epl = estimator.epl_for_each_K();
+  ASSERT_EQ(epl.size(), k_up);
+  for (int k = 1; k < k_up; k++) {
+    ASSERT_LE(epl(k), epl(k - 1) + 1e-12);
+  }
+  Eigen::VectorXi init_k = init;
+  Eigen::VectorXi a = estimator.greedy_algorithm(init_k);
+  ASSERT_LE(epl(k_up - 1), estimator.expected_posterior_loss(a) + 1e-12);
+}
+
+TEST(cluster_utils, unique_partitions) {
+  int n = 20;
+  Eigen::MatrixXi distinct = random_sample(5, n, 3);
+  // each partition repeated, with its labels permuted in the copies
+  int t = 23;
+  Eigen::MatrixXi sample(t, n);
+  for (int k = 0; k < t; k++) {
+    sample.row(k) = distinct.row(k % 5) * (k + 1);
+    sample.row(k).array() += k;
+  }
+  bayesmix::UniquePartitions unique = bayesmix::unique_partitions(sample);
+  ASSERT_EQ(unique.partitions.rows(), 5);
+  ASSERT_EQ(unique.counts.sum(), t);
+  for (int k = 0; k < t; k++) {
+    int u = unique.index(k);
+    ASSERT_EQ(u, k % 5);
+    ASSERT_EQ(unique.first(u), u);
+    for (int i = 0; i < n; i++) {
+      for (int j = 0; j < n; j++) {
+        ASSERT_EQ(unique.partitions(u, i) == unique.partitions(u, j),
+                  sample(k, i) == sample(k, j));
+      }
+    }
+  }
+
+  // the weighted PSM equals the one of the whole chain
+  Eigen::MatrixXf psm = bayesmix::posterior_similarity(sample);
+  Eigen::MatrixXf weighted =
+      bayesmix::posterior_similarity(unique.partitions, unique.counts);
+  ASSERT_TRUE(psm.isApprox(weighted));
+
+  // as well as the expected posterior loss
+  Eigen::VectorXi a = random_partition(n, 4);
+  Eigen::VectorXi init = Eigen::VectorXi::LinSpaced(n, 1, n);
+  ClusterEstimator estimator(sample, VARIATION_INFORMATION, n, init);
+  VariationInformation vi(false);
+  ASSERT_NEAR(estimator.expected_posterior_loss(a),
+              vi.LossAgainstSample(a, sample).mean(), 1e-12);
+}
+
+TEST(cluster_estimator, vi_lower_bound) {
+  int n = 40;
+  Eigen::MatrixXi sample = random_sample(30, n, 3);
+  Eigen::VectorXi init = Eigen::VectorXi::LinSpaced(n, 1, n);
+  ClusterEstimator bound(sample, VARIATION_INFORMATION_LOWER_BOUND, n, init);
+  ClusterEstimator vi(sample, VARIATION_INFORMATION, n, init);
+  for (int k : {1, 3, 10}) {
+    Eigen::VectorXi a = random_partition(n, k);
+    ASSERT_LE(bound.expected_posterior_loss(a),
+              vi.expected_posterior_loss(a) + 1e-9);
+  }
+  // the bound is exact when all samples are the same
+  Eigen::MatrixXi constant = sample.row(0).replicate(5, 1);
+  ClusterEstimator exact(constant, VARIATION_INFORMATION_LOWER_BOUND, n, init);
+  Eigen::VectorXi a = random_partition(n, 4);
+  VariationInformation loss(false);
+  ASSERT_NEAR(exact.expected_posterior_loss(a),
+              loss.Loss(a, sample.row(0).transpose()), 1e-6);
+
+  Eigen::MatrixXi one = sample.topRows(1);
+  ASSERT_THROW(
+      CredibleBall(VARIATION_INFORMATION_LOWER_BOUND, one, 0.05, init),
+      std::domain_error);
+}
+
+TEST(loss_function, many_groups) {
+  // K1 * K2 much larger than N: the table is built without a dense buffer
+  int n = 300;
+  Eigen::MatrixXi sample(3, n);
+  for (int t = 0; t < 3; t++) {
+    sample.row(t) = random_partition(n, 60 + t, 1000).transpose();
+  }
+  Eigen::VectorXi a = random_partition(n, 70);
+  BinderLoss binder(1.0, 2.0);
+  Eigen::VectorXd losses = binder.LossAgainstSample(a, sample);
+  for (int t = 0; t < 3; t++) {
+    double expected = 0.0;
+    for (int i = 0; i < n; i++) {
+      for (int j = i + 1; j < n; j++) {
+        bool same1 = (a(i) == a(j));
+        bool same2 = (sample(t, i) == sample(t, j));
+        expected += 1.0 * (!same1 && same2) + 2.0 * (same1 && !same2);
+      }
+    }
+    ASSERT_DOUBLE_EQ(losses(t), expected);
+    // rows of the sample are used without copies
+    ASSERT_DOUBLE_EQ(binder.Loss(a, sample.row(t)), expected);
+  }
+}
+
+TEST(loss_function, compact_partitions) {
+  int n = 200;
+  Eigen::MatrixXi sample(4, n);
+  for (int t = 0; t < 4; t++) {
+    sample.row(t) = random_partition(n, 5 + 10 * t, 100000).transpose();
+  }
+  CompactPartitions compact(sample);
+  ASSERT_TRUE(compact.HasSmallLabels());
+  for (int t = 0; t < 4; t++) {
+    std::vector<int> labels;
+    int K = ContingencyTable::CompactLabels(sample.row(t), labels);
+    ASSERT_EQ(compact.GetNumberOfGroups(t), K);
+    for (int i = 0; i < n; i++) {
+      ASSERT_EQ(compact.GetLabel(t, i), labels[i]);
+    }
+  }
+
+  // 16-bit labels give the same losses as the original sample
+  Eigen::VectorXi a = random_partition(n, 12);
+  VariationInformation vi(false);
+  Eigen::VectorXd losses = vi.LossAgainstSample(a, compact);
+  for (int t = 0; t < 4; t++) {
+    ASSERT_NEAR(losses(t), vi.Loss(a, sample.row(t)), 1e-12);
+  }
+}
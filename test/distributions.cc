@@ -58,3 +58,43 @@ TEST(mix_dist, 2) {
 
   ASSERT_DOUBLE_EQ(dist_to_self, 0.0);
 }
+
+TEST(wishart_bartlett, factor) {
+  auto& rng = bayesmix::Rng::Instance().get();
+  unsigned int dim = 3;
+  double deg_free = 6.5;
+  Eigen::Matrix3d scale;
+  scale << 2.0, 0.5, 0.2, 0.5, 1.0, 0.3, 0.2, 0.3, 1.5;
+  Eigen::MatrixXd factor =
+      Eigen::LLT<Eigen::MatrixXd>(Eigen::MatrixXd(scale.reverse()))
+          .matrixL();
+  factor = factor.reverse().eval();
+  ASSERT_TRUE((factor * factor.transpose()).isApprox(scale));
+
+  int n_draws = 20000;
+  Eigen::MatrixXd mean = Eigen::MatrixXd::Zero(dim, dim);
+  for (int i = 0; i < n_draws; i++) {
+    Eigen::MatrixXd bartlett(dim, dim);
+    bayesmix::wishart_bartlett_rng(deg_free, rng, bartlett);
+    ASSERT_TRUE(bartlett.isUpperTriangular());
+    ASSERT_GT(bartlett.diagonal().minCoeff(), 0.0);
+    Eigen::MatrixXd draw_factor = factor * bartlett;
+    mean += draw_factor * draw_factor.transpose() / n_draws;
+  }
+  // E[W] = deg_free * scale
+  ASSERT_LT((mean - deg_free * scale).norm() / (deg_free * scale).norm(),
+            0.05);
+}
+
+TEST(student_t, log_const) {
+  double mu = 1.5;
+  double sigma = 0.7;
+  for (double nu : {1.0, 3.0, 12.5}) {
+    for (double x : {-2.0, 0.3, 4.0}) {
+      double z = (x - mu) / sigma;
+      double lpdf = bayesmix::student_t_log_const(nu) - std::log(sigma) -
+                    0.5 * (nu + 1) * std::log1p(z * z / nu);
+      ASSERT_NEAR(lpdf, stan::math::student_t_lpdf(x, nu, mu, sigma), 1e-12);
+    }
+  }
+}
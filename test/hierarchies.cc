@@ -5,6 +5,8 @@
 
 #include "ls_state.pb.h"
 #include "marginal_state.pb.h"
+#include "src/hierarchies/diag_nnig_hierarchy.h"
+#include "src/hierarchies/factor_hierarchy.h"
 #include "src/hierarchies/lin_reg_uni_hierarchy.h"
 #include "src/hierarchies/nnig_hierarchy.h"
 #include "src/hierarchies/nnw_hierarchy.h"
@@ -67,6 +69,36 @@ TEST(nnighierarchy, sample_given_data) {
   ASSERT_TRUE(clusval->DebugString() != clusval2->DebugString());
 }
 
+TEST(nnighierarchy, fixed_hypers) {
+  auto hier = std::make_shared<NNIGHierarchy>();
+  bayesmix::NNIGPrior prior;
+  prior.mutable_fixed_values()->set_mean(5.0);
+  prior.mutable_fixed_values()->set_var_scaling(0.1);
+  prior.mutable_fixed_values()->set_shape(2.0);
+  prior.mutable_fixed_values()->set_scale(2.0);
+  hier->set_prior(prior);
+  hier->initialize();
+  ASSERT_TRUE(hier->has_fixed_hypers());
+
+  // Hyperparameters, hence the marginal density, are unchanged by an update
+  Eigen::RowVectorXd datum(1);
+  datum << 4.5;
+  double marg = hier->marg_lpdf(datum);
+  bayesmix::MarginalState::ClusterState clusval;
+  hier->write_state_to_proto(&clusval);
+  hier->update_hypers({clusval});
+  ASSERT_DOUBLE_EQ(hier->marg_lpdf(datum), marg);
+
+  bayesmix::NNIGPrior prior2;
+  prior2.mutable_normal_mean_prior()->mutable_mean_prior()->set_mean(5.0);
+  prior2.mutable_normal_mean_prior()->mutable_mean_prior()->set_var(1.0);
+  prior2.mutable_normal_mean_prior()->set_var_scaling(0.1);
+  prior2.mutable_normal_mean_prior()->set_shape(2.0);
+  prior2.mutable_normal_mean_prior()->set_scale(2.0);
+  hier->set_prior(prior2);
+  ASSERT_FALSE(hier->has_fixed_hypers());
+}
+
 TEST(nnwhierarchy, draw) {
   auto hier = std::make_shared<NNWHierarchy>();
   bayesmix::NNWPrior prior;
@@ -133,6 +165,253 @@ TEST(nnwhierarchy, sample_given_data) {
   ASSERT_TRUE(clusval->DebugString() != clusval2->DebugString());
 }
 
+TEST(nnwhierarchy, lpdf_grid) {
+  auto hier = std::make_shared<NNWHierarchy>();
+  bayesmix::NNWPrior prior;
+  Eigen::Vector2d mu0;
+  mu0 << 5.5, 5.5;
+  bayesmix::to_proto(mu0, prior.mutable_fixed_values()->mutable_mean());
+  prior.mutable_fixed_values()->set_var_scaling(0.2);
+  prior.mutable_fixed_values()->set_deg_free(5.0);
+  Eigen::Matrix2d tau0;
+  tau0 << 0.2, 0.05, 0.05, 0.3;
+  bayesmix::to_proto(tau0, prior.mutable_fixed_values()->mutable_scale());
+  hier->set_prior(prior);
+  hier->initialize();
+  hier->draw();
+
+  Eigen::MatrixXd grid(4, 2);
+  grid << 4.5, 4.5, 5.0, 6.0, 7.0, 3.5, 5.5, 5.5;
+  Eigen::VectorXd like = hier->like_lpdf_grid(grid);
+  Eigen::VectorXd marg = hier->marg_lpdf_grid(grid);
+  for (int i = 0; i < grid.rows(); i++) {
+    ASSERT_NEAR(like(i), hier->like_lpdf(grid.row(i)), 1e-10);
+    ASSERT_NEAR(marg(i), hier->marg_lpdf(grid.row(i)), 1e-10);
+  }
+}
+
+TEST(nnwhierarchy, incremental_posterior) {
+  auto hier = std::make_shared<NNWHierarchy>();
+  bayesmix::NNWPrior prior;
+  Eigen::Vector2d mu0;
+  mu0 << 5.5, 5.5;
+  bayesmix::to_proto(mu0, prior.mutable_fixed_values()->mutable_mean());
+  prior.mutable_fixed_values()->set_var_scaling(0.2);
+  prior.mutable_fixed_values()->set_deg_free(5.0);
+  Eigen::Matrix2d tau0;
+  tau0 << 0.2, 0.05, 0.05, 0.3;
+  bayesmix::to_proto(tau0, prior.mutable_fixed_values()->mutable_scale());
+  hier->set_prior(prior);
+  hier->initialize();
+
+  Eigen::MatrixXd data(3, 2);
+  data << 4.5, 4.0, 6.0, 5.5, 3.0, 7.5;
+  auto &rng = bayesmix::Rng::Instance().get();
+
+  // Posterior utilities are updated as data are added and removed...
+  auto hier1 = hier->clone();
+  hier1->add_datum(0, data.row(0));
+  hier1->sample_given_data();
+  hier1->add_datum(1, data.row(1));
+  hier1->add_datum(2, data.row(2));
+  hier1->remove_datum(1, data.row(1));
+  rng.seed(20201124);
+  hier1->sample_given_data();
+
+  // ...or computed from scratch
+  auto hier2 = hier->clone();
+  hier2->add_datum(0, data.row(0));
+  hier2->add_datum(2, data.row(2));
+  rng.seed(20201124);
+  hier2->sample_given_data();
+
+  bayesmix::MarginalState::ClusterState clusval1, clusval2;
+  hier1->write_state_to_proto(&clusval1);
+  hier2->write_state_to_proto(&clusval2);
+  Eigen::VectorXd mean1 = bayesmix::to_eigen(clusval1.multi_ls_state().mean());
+  Eigen::VectorXd mean2 = bayesmix::to_eigen(clusval2.multi_ls_state().mean());
+  Eigen::MatrixXd prec1 = bayesmix::to_eigen(clusval1.multi_ls_state().prec());
+  Eigen::MatrixXd prec2 = bayesmix::to_eigen(clusval2.multi_ls_state().prec());
+  ASSERT_TRUE(mean1.isApprox(mean2, 1e-8));
+  ASSERT_TRUE(prec1.isApprox(prec2, 1e-8));
+}
+
+TEST(nnwhierarchy, incremental_posterior_drift) {
+  auto hier = std::make_shared<NNWHierarchy>();
+  bayesmix::NNWPrior prior;
+  Eigen::Vector3d mu0 = Eigen::Vector3d::Zero();
+  bayesmix::to_proto(mu0, prior.mutable_fixed_values()->mutable_mean());
+  prior.mutable_fixed_values()->set_var_scaling(0.1);
+  prior.mutable_fixed_values()->set_deg_free(5.0);
+  Eigen::Matrix3d tau0 = Eigen::Matrix3d::Identity();
+  bayesmix::to_proto(tau0, prior.mutable_fixed_values()->mutable_scale());
+  hier->set_prior(prior);
+  hier->initialize();
+  auto &rng = bayesmix::Rng::Instance().get();
+
+  // A long-lived cluster sees many data come and go, with rank-one updates
+  // of its posterior utilities...
+  Eigen::MatrixXd data = Eigen::MatrixXd::Random(4, 3);
+  auto hier1 = hier->clone();
+  for (int i = 0; i < data.rows(); i++) {
+    hier1->add_datum(i, data.row(i));
+  }
+  hier1->sample_given_data();
+  for (int iter = 0; iter < 20000; iter++) {
+    Eigen::VectorXd datum = 100.0 * Eigen::VectorXd::Random(3);
+    hier1->add_datum(data.rows(), datum);
+    hier1->remove_datum(data.rows(), datum);
+  }
+  rng.seed(20201124);
+  hier1->sample_given_data();
+
+  // ...which stay close to a fresh factorization of the same data
+  auto hier2 = hier->clone();
+  for (int i = 0; i < data.rows(); i++) {
+    hier2->add_datum(i, data.row(i));
+  }
+  rng.seed(20201124);
+  hier2->sample_given_data();
+
+  bayesmix::MarginalState::ClusterState clusval1, clusval2;
+  hier1->write_state_to_proto(&clusval1);
+  hier2->write_state_to_proto(&clusval2);
+  Eigen::VectorXd mean1 = bayesmix::to_eigen(clusval1.multi_ls_state().mean());
+  Eigen::VectorXd mean2 = bayesmix::to_eigen(clusval2.multi_ls_state().mean());
+  Eigen::MatrixXd prec1 = bayesmix::to_eigen(clusval1.multi_ls_state().prec());
+  Eigen::MatrixXd prec2 = bayesmix::to_eigen(clusval2.multi_ls_state().prec());
+  ASSERT_TRUE(mean1.isApprox(mean2, 1e-10));
+  ASSERT_TRUE(prec1.isApprox(prec2, 1e-10));
+}
+
+TEST(nnwhierarchy, fixed_dimension) {
+  bayesmix::NNWPrior prior;
+  Eigen::Vector2d mu0;
+  mu0 << 5.5, 5.5;
+  bayesmix::to_proto(mu0, prior.mutable_fixed_values()->mutable_mean());
+  prior.mutable_fixed_values()->set_var_scaling(0.2);
+  prior.mutable_fixed_values()->set_deg_free(5.0);
+  Eigen::Matrix2d tau0;
+  tau0 << 0.2, 0.05, 0.05, 0.3;
+  bayesmix::to_proto(tau0, prior.mutable_fixed_values()->mutable_scale());
+
+  auto hier = std::make_shared<NNWHierarchy>();
+  auto hier2 = std::make_shared<NNW2Hierarchy>();
+  hier->set_prior(prior);
+  hier2->set_prior(prior);
+  hier->initialize();
+  hier2->initialize();
+  ASSERT_EQ(hier2->get_id(), "NNW2");
+
+  // Both hierarchies must agree on the same state and data
+  Eigen::MatrixXd data(3, 2);
+  data << 4.5, 4.0, 6.0, 5.5, 3.0, 7.5;
+  bayesmix::MarginalState::ClusterState clusval;
+  hier->add_datum(0, data.row(0));
+  hier->sample_given_data();
+  hier->write_state_to_proto(&clusval);
+  hier2->set_state_from_proto(clusval);
+  for (int i = 0; i < data.rows(); i++) {
+    ASSERT_NEAR(hier->like_lpdf(data.row(i)), hier2->like_lpdf(data.row(i)),
+                1e-10);
+    ASSERT_NEAR(hier->marg_lpdf(data.row(i)), hier2->marg_lpdf(data.row(i)),
+                1e-10);
+  }
+
+  // A prior of a different dimension is rejected
+  auto hier3 = std::make_shared<NNW3Hierarchy>();
+  ASSERT_THROW(hier3->set_prior(prior), std::invalid_argument);
+}
+
+TEST(diagnnighierarchy, sample_given_data) {
+  auto hier = std::make_shared<DiagNNIGHierarchy>();
+  bayesmix::DiagNNIGPrior prior;
+  Eigen::Vector3d mu0, beta0;
+  mu0 << 5.5, 5.5, 0.0;
+  beta0 << 2.0, 1.0, 0.5;
+  bayesmix::to_proto(mu0, prior.mutable_fixed_values()->mutable_mean());
+  prior.mutable_fixed_values()->set_var_scaling(0.1);
+  prior.mutable_fixed_values()->set_shape(2.0);
+  bayesmix::to_proto(beta0, prior.mutable_fixed_values()->mutable_scale());
+  hier->set_prior(prior);
+  hier->initialize();
+
+  Eigen::MatrixXd data(3, 3);
+  data << 4.5, 4.0, 1.0, 6.0, 5.5, -0.5, 3.0, 7.5, 0.2;
+  auto hier2 = hier->clone();
+  for (int i = 0; i < data.rows(); i++) {
+    hier2->add_datum(i, data.row(i));
+  }
+  hier2->sample_given_data();
+
+  bayesmix::MarginalState out;
+  bayesmix::MarginalState::ClusterState* clusval = out.add_cluster_states();
+  bayesmix::MarginalState::ClusterState* clusval2 = out.add_cluster_states();
+  hier->write_state_to_proto(clusval);
+  hier2->write_state_to_proto(clusval2);
+  ASSERT_TRUE(clusval->DebugString() != clusval2->DebugString());
+  ASSERT_EQ(clusval2->diag_ls_state().var().data_size(), 3);
+
+  // Grid evaluations agree with pointwise ones
+  Eigen::VectorXd like = hier2->like_lpdf_grid(data);
+  Eigen::VectorXd marg = hier2->marg_lpdf_grid(data);
+  for (int i = 0; i < data.rows(); i++) {
+    ASSERT_NEAR(like(i), hier2->like_lpdf(data.row(i)), 1e-10);
+    ASSERT_NEAR(marg(i), hier2->marg_lpdf(data.row(i)), 1e-10);
+  }
+}
+
+TEST(factorhierarchy, sample_given_data) {
+  auto hier = std::make_shared<FactorHierarchy>();
+  bayesmix::FactorPrior prior;
+  Eigen::Vector3d mu0, beta0;
+  mu0 << 0.0, 0.0, 0.0;
+  beta0 << 1.0, 1.0, 1.0;
+  bayesmix::to_proto(mu0, prior.mutable_fixed_values()->mutable_mean());
+  prior.mutable_fixed_values()->set_mean_var(100.0);
+  prior.mutable_fixed_values()->set_num_factors(1);
+  prior.mutable_fixed_values()->set_loadings_var(1.0);
+  prior.mutable_fixed_values()->set_shape(2.0);
+  bayesmix::to_proto(beta0, prior.mutable_fixed_values()->mutable_scale());
+  hier->set_prior(prior);
+  hier->initialize();
+  ASSERT_FALSE(hier->is_conjugate());
+
+  // Data around (5, -5, 2), with the first two coordinates correlated
+  auto &rng = bayesmix::Rng::Instance().get();
+  rng.seed(20201124);
+  Eigen::MatrixXd data(100, 3);
+  for (int i = 0; i < data.rows(); i++) {
+    double eta = stan::math::normal_rng(0, 1, rng);
+    data(i, 0) = 5.0 + eta + stan::math::normal_rng(0, 0.3, rng);
+    data(i, 1) = -5.0 + eta + stan::math::normal_rng(0, 0.3, rng);
+    data(i, 2) = 2.0 + stan::math::normal_rng(0, 0.3, rng);
+  }
+  auto hier2 = hier->clone();
+  for (int i = 0; i < data.rows(); i++) {
+    hier2->add_datum(i, data.row(i));
+  }
+  hier2->add_datum(data.rows(), Eigen::Vector3d(100.0, 100.0, 100.0));
+  hier2->remove_datum(data.rows(), Eigen::Vector3d(100.0, 100.0, 100.0));
+  for (int it = 0; it < 200; it++) {
+    hier2->sample_given_data();
+  }
+
+  bayesmix::MarginalState::ClusterState clusval;
+  hier2->write_state_to_proto(&clusval);
+  Eigen::VectorXd mean = bayesmix::to_eigen(clusval.factor_ls_state().mean());
+  ASSERT_TRUE(mean.isApprox(Eigen::Vector3d(5.0, -5.0, 2.0), 0.1));
+  ASSERT_EQ(clusval.factor_ls_state().loadings().rows(), 3);
+  ASSERT_EQ(clusval.factor_ls_state().loadings().cols(), 1);
+
+  // Grid evaluations agree with pointwise ones
+  Eigen::VectorXd like = hier2->like_lpdf_grid(data.topRows(5));
+  for (int i = 0; i < 5; i++) {
+    ASSERT_NEAR(like(i), hier2->like_lpdf(data.row(i)), 1e-10);
+  }
+  ASSERT_THROW(hier2->marg_lpdf(data.row(0)), std::runtime_error);
+}
+
 TEST(lin_reg_uni_hierarchy, state_read_write) {
   Eigen::Vector2d beta;
   beta << 2, -1;
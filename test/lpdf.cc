@@ -5,6 +5,8 @@
 #include <stan/math/prim/prob.hpp>
 
 #include "marginal_state.pb.h"
+#include "src/hierarchies/diag_nnig_hierarchy.h"
+#include "src/hierarchies/factor_hierarchy.h"
 #include "src/hierarchies/lin_reg_uni_hierarchy.h"
 #include "src/hierarchies/nnig_hierarchy.h"
 #include "src/hierarchies/nnw_hierarchy.h"
@@ -54,6 +56,118 @@ TEST(lpdf, nnig) {
   ASSERT_DOUBLE_EQ(sum, marg);
 }
 
+TEST(lpdf, nnig_cached) {
+  NNIGHierarchy hier;
+  bayesmix::NNIGPrior hier_prior;
+  hier_prior.mutable_ngg_prior()->mutable_mean_prior()->set_mean(5.5);
+  hier_prior.mutable_ngg_prior()->mutable_mean_prior()->set_var(2.25);
+  hier_prior.mutable_ngg_prior()->mutable_var_scaling_prior()->set_shape(0.2);
+  hier_prior.mutable_ngg_prior()->mutable_var_scaling_prior()->set_rate(0.6);
+  hier_prior.mutable_ngg_prior()->set_shape(1.5);
+  hier_prior.mutable_ngg_prior()->mutable_scale_prior()->set_shape(4.0);
+  hier_prior.mutable_ngg_prior()->mutable_scale_prior()->set_rate(2.0);
+  hier.set_prior(hier_prior);
+  hier.initialize();
+  hier.draw();
+
+  // The cached constants are refreshed when the hyperparameters change
+  bayesmix::MarginalState::ClusterState state;
+  hier.write_state_to_proto(&state);
+  hier.update_hypers({state});
+
+  Eigen::MatrixXd grid(3, 1);
+  grid << 4.5, 5.5, 9.0;
+  auto hypers = hier.get_hypers();
+  auto st = hier.get_state();
+  double sig_n = sqrt(hypers.scale * (hypers.var_scaling + 1) /
+                      (hypers.shape * hypers.var_scaling));
+  Eigen::VectorXd like = hier.like_lpdf_grid(grid);
+  Eigen::VectorXd marg = hier.marg_lpdf_grid(grid);
+  for (int i = 0; i < grid.rows(); i++) {
+    double x = grid(i, 0);
+    double like_ = stan::math::normal_lpdf(x, st.mean, sqrt(st.var));
+    double marg_ =
+        stan::math::student_t_lpdf(x, 2 * hypers.shape, hypers.mean, sig_n);
+    ASSERT_NEAR(like_, hier.like_lpdf(grid.row(i)), 1e-10);
+    ASSERT_NEAR(like_, like(i), 1e-10);
+    ASSERT_NEAR(marg_, hier.marg_lpdf(grid.row(i)), 1e-10);
+    ASSERT_NEAR(marg_, marg(i), 1e-10);
+  }
+}
+
+TEST(lpdf, diag_nnig) {
+  // The diagonal hierarchy is a product of univariate NNIG hierarchies
+  Eigen::Vector2d mu0, beta0;
+  mu0 << 5.0, -1.0;
+  beta0 << 2.0, 0.5;
+  double lambda0 = 0.1;
+  double alpha0 = 2.0;
+
+  DiagNNIGHierarchy hier;
+  bayesmix::DiagNNIGPrior hier_prior;
+  bayesmix::to_proto(mu0, hier_prior.mutable_fixed_values()->mutable_mean());
+  hier_prior.mutable_fixed_values()->set_var_scaling(lambda0);
+  hier_prior.mutable_fixed_values()->set_shape(alpha0);
+  bayesmix::to_proto(beta0,
+                     hier_prior.mutable_fixed_values()->mutable_scale());
+  hier.set_prior(hier_prior);
+  hier.initialize();
+  hier.draw();
+
+  Eigen::RowVectorXd datum(2);
+  datum << 4.5, 0.3;
+  double like = 0.0;
+  double marg = 0.0;
+  for (int j = 0; j < 2; j++) {
+    NNIGHierarchy uni;
+    bayesmix::NNIGPrior uni_prior;
+    uni_prior.mutable_fixed_values()->set_mean(mu0(j));
+    uni_prior.mutable_fixed_values()->set_var_scaling(lambda0);
+    uni_prior.mutable_fixed_values()->set_shape(alpha0);
+    uni_prior.mutable_fixed_values()->set_scale(beta0(j));
+    uni.set_prior(uni_prior);
+    bayesmix::MarginalState::ClusterState state;
+    state.mutable_uni_ls_state()->set_mean(hier.get_state().mean(j));
+    state.mutable_uni_ls_state()->set_var(hier.get_state().var(j));
+    uni.set_state_from_proto(state);
+    Eigen::RowVectorXd x(1);
+    x << datum(j);
+    like += uni.like_lpdf(x);
+    marg += uni.marg_lpdf(x);
+  }
+
+  ASSERT_NEAR(like, hier.like_lpdf(datum), 1e-10);
+  ASSERT_NEAR(marg, hier.marg_lpdf(datum), 1e-10);
+}
+
+TEST(lpdf, factor_like) {
+  FactorHierarchy hier;
+  bayesmix::FactorPrior hier_prior;
+  Eigen::VectorXd mu0(4), beta0(4);
+  mu0 << 1.0, -1.0, 0.5, 2.0;
+  beta0 << 2.0, 1.0, 0.5, 1.5;
+  bayesmix::to_proto(mu0, hier_prior.mutable_fixed_values()->mutable_mean());
+  hier_prior.mutable_fixed_values()->set_mean_var(4.0);
+  hier_prior.mutable_fixed_values()->set_num_factors(2);
+  hier_prior.mutable_fixed_values()->set_loadings_var(1.0);
+  hier_prior.mutable_fixed_values()->set_shape(2.0);
+  bayesmix::to_proto(beta0,
+                     hier_prior.mutable_fixed_values()->mutable_scale());
+  hier.set_prior(hier_prior);
+  hier.initialize();
+  hier.draw();
+
+  // The Woodbury evaluation agrees with the full covariance matrix
+  auto state = hier.get_state();
+  Eigen::MatrixXd cov = state.loadings * state.loadings.transpose();
+  cov.diagonal() += state.noise_var;
+  Eigen::RowVectorXd datum(4);
+  datum << 0.5, -0.3, 1.2, 2.5;
+  double like = stan::math::multi_normal_lpdf(datum, state.mean, cov);
+
+  ASSERT_NEAR(like, hier.like_lpdf(datum), 1e-10);
+}
+
 // TEST(lpdf, nnw) {  // TODO
 //   using namespace stan::math;
 //   NNWHierarchy hier;
@@ -137,6 +251,36 @@ TEST(lpdf, nnig) {
 //   ASSERT_DOUBLE_EQ(marg, marg_murphy);
 // }
 
+TEST(lpdf, nnw_marg) {
+  NNWHierarchy hier;
+  bayesmix::NNWPrior hier_prior;
+  Eigen::Vector3d mu0;
+  mu0 << 5.5, 5.0, 4.5;
+  double lambda0 = 0.2;
+  double nu0 = 5.0;
+  Eigen::Matrix3d tau0;
+  tau0 << 1.0, 0.3, 0.1, 0.3, 2.0, 0.2, 0.1, 0.2, 0.5;
+  bayesmix::to_proto(mu0, hier_prior.mutable_fixed_values()->mutable_mean());
+  hier_prior.mutable_fixed_values()->set_var_scaling(lambda0);
+  hier_prior.mutable_fixed_values()->set_deg_free(nu0);
+  bayesmix::to_proto(tau0, hier_prior.mutable_fixed_values()->mutable_scale());
+  hier.set_prior(hier_prior);
+  hier.initialize();
+
+  // Marginal distribution: multivariate Student's t
+  int dim = 3;
+  double nu_n = 2 * nu0 - dim + 1;
+  Eigen::MatrixXd sigma_n = stan::math::inverse_spd(tau0) *
+                            (nu0 - 0.5 * (dim - 1)) * lambda0 / (lambda0 + 1);
+
+  Eigen::RowVectorXd datum(3);
+  datum << 4.5, 6.0, 3.0;
+  double marg = stan::math::multi_student_t_lpdf(datum, nu_n, mu0, sigma_n);
+  ASSERT_NEAR(hier.marg_lpdf(datum), marg, 1e-10);
+  // Clones share the cached marginal utilities
+  ASSERT_NEAR(hier.clone()->marg_lpdf(datum), marg, 1e-10);
+}
+
 TEST(lpdf, lin_reg_uni) {
   // Create hierarchy objects
   LinRegUniHierarchy hier;
@@ -197,3 +341,40 @@ TEST(lpdf, lin_reg_uni) {
 
   ASSERT_FLOAT_EQ(sum, marg);
 }
+
+TEST(lpdf, lin_reg_uni_grid) {
+  LinRegUniHierarchy hier;
+  bayesmix::LinRegUniPrior prior;
+  int dim = 3;
+  Eigen::VectorXd mu0(dim);
+  mu0 << 1.0, -0.5, 2.0;
+  Eigen::MatrixXd Lambda0(dim, dim);
+  Lambda0 << 2.0, 0.3, 0.1, 0.3, 1.0, 0.2, 0.1, 0.2, 0.5;
+  bayesmix::to_proto(mu0, prior.mutable_fixed_values()->mutable_mean());
+  bayesmix::to_proto(Lambda0,
+                     prior.mutable_fixed_values()->mutable_var_scaling());
+  prior.mutable_fixed_values()->set_shape(2.0);
+  prior.mutable_fixed_values()->set_scale(2.0);
+  hier.set_prior(prior);
+  hier.initialize();
+  hier.draw();
+
+  Eigen::MatrixXd covs = Eigen::MatrixXd::Random(5, dim);
+  Eigen::MatrixXd data = Eigen::MatrixXd::Random(5, 1);
+  Eigen::VectorXd like = hier.like_lpdf_grid(data, covs);
+  Eigen::VectorXd marg = hier.marg_lpdf_grid(data, covs);
+  auto hypers = hier.get_hypers();
+  auto state = hier.get_state();
+  for (int i = 0; i < data.rows(); i++) {
+    Eigen::VectorXd x = covs.row(i).transpose();
+    double like_ = stan::math::normal_lpdf(
+        data(i, 0), x.dot(state.regression_coeffs), sqrt(state.var));
+    double sig_n = sqrt((1 + x.dot(Lambda0.llt().solve(x))) * hypers.scale /
+                        hypers.shape);
+    double marg_ = stan::math::student_t_lpdf(data(i, 0), 2 * hypers.shape,
+                                              x.dot(mu0), sig_n);
+    ASSERT_NEAR(like_, like(i), 1e-10);
+    ASSERT_NEAR(marg_, marg(i), 1e-10);
+    ASSERT_NEAR(marg_, hier.marg_lpdf(data.row(i), covs.row(i)), 1e-10);
+  }
+}